@@ -883,6 +883,13 @@ public:
       return dev;
     }
 
+  /// Delete device and remove it from the list.
+  void erase(unsigned i)
+    {
+      delete m_list.at(i);
+      m_list.erase(m_list.begin() + i);
+    }
+
   void append(smart_device_list & devlist)
     {
       for (unsigned i = 0; i < devlist.size(); i++) {
@@ -103,6 +103,8 @@ private:
 
   typedef std::vector<node_info> node_path;
 
+  struct node;
+
 public:
   /// Reference to a JSON element.
   class ref
@@ -167,10 +169,18 @@ public:
     ref(const ref & base, const char * /*dummy*/, const char * key_suffix);
 
     void operator=(const initlist_value & value)
-      { m_js.set_initlist_value(m_path, value); }
+      { m_js.set_initlist_value(*this, value); }
+
+    /// Return node of this element if it already exists, else nullptr.
+    node * find_node() const;
 
     json & m_js;
     node_path m_path;
+    // Cached nodes of the parent element and of this element, valid
+    // if m_cache_gen matches json::m_cache_gen.
+    mutable node * m_parent_node = nullptr;
+    mutable node * m_node = nullptr;
+    mutable unsigned m_cache_gen = 0;
   };
 
   /// Return reference to element of top level object.
@@ -185,6 +195,10 @@ public:
   void operator+=(std::initializer_list<initlist_key_value_pair> ilist)
     { ref(*this) += ilist; }
 
+  /// Remove all elements and disable streaming output.
+  /// Allocated nodes are kept and reused for the next tree.
+  void clear();
+
   /// Enable/disable JSON output.
   void enable(bool yes = true)
     { m_enabled = yes; }
@@ -210,6 +224,9 @@ public:
     virtual void formatv(const char * fmt, va_list ap);
     virtual void format(const char * fmt, ...)
       SMARTMON_FORMAT_PRINTF(2, 3);
+    /// Binary output, used for CBOR format.
+    /// Default implementation does not support null bytes.
+    virtual void write(const void * data, unsigned size);
   };
 
 protected:
@@ -242,9 +259,18 @@ public:
   struct output_options {
     bool pretty = false; //< Pretty-print output.
     bool sorted = false; //< Sort object keys.
-    char format = 0; //< 'y': YAML, 'g': flat(grep, gron), other: JSON
+    char format = 0; //< 'y': YAML, 'g': flat(grep, gron), 'b': CBOR, other: JSON
   };
 
+  /// Enable streaming output: Top level elements written by flush() are
+  /// output immediately, output() then writes the remaining elements.
+  /// Ignored (tree is used) unless OPTIONS select unsorted JSON format.
+  void set_streaming(output_function & out, const output_options & options);
+
+  /// If streaming output is enabled, output top level element KEYSTR now
+  /// and remove it from the tree.  The element must not be changed later.
+  void flush(const char * keystr);
+
   /// Output JSON tree using an implementation of 'output_function'.
   void output(output_function & out, const output_options & options) const;
 
@@ -269,7 +295,6 @@ private:
   {
     node();
     node(const node &) = delete;
-    explicit node(const std::string & key_);
     ~node();
     void operator=(const node &) = delete;
 
@@ -279,9 +304,17 @@ private:
     std::string strval;
 
     std::string key;
-    std::vector< std::unique_ptr<node> > childs;
-    typedef std::map<std::string, unsigned> keymap;
-    keymap key2index;
+    std::vector<node *> childs; // Owned by json::m_node_blocks, nullptr if unset
+    std::vector<unsigned> key_table; // Hash of object keys: child index + 1, 0 if free
+
+    /// Return object element or nullptr if not found.
+    node * find_child(const std::string & key_) const;
+    /// Append object element.
+    void add_child(node * p);
+    /// Remove object element with index I.
+    void remove_child(unsigned i);
+    /// Reset to default constructed state, keep allocated memory.
+    void reset();
 
     class const_iterator
     {
@@ -294,9 +327,8 @@ private:
 
     private:
       const node * m_node_p;
-      bool m_use_map;
       unsigned m_child_idx = 0;
-      keymap::const_iterator m_key_iter;
+      std::vector<const node *> m_sorted; // Object elements sorted by key if requested
     };
   };
 
@@ -306,20 +338,42 @@ private:
 
   node m_root_node;
 
-  node * find_or_create_node(const node_path & path, node_type type);
+  // Storage for all other nodes, allocated in blocks.
+  static const unsigned node_block_size = 256;
+  std::vector< std::unique_ptr<node[]> > m_node_blocks;
+  unsigned m_node_block_used = node_block_size;
+
+  // Nodes removed from the tree, reused by new_node().
+  std::vector<node *> m_free_nodes;
+
+  // Streaming output, see set_streaming().
+  output_function * m_stream_out = nullptr;
+  bool m_stream_pretty = false;
+  bool m_stream_started = false;
+  std::vector<std::string> m_flushed_keys;
+
+  // Incremented if nodes are removed, invalidates node pointers cached in refs.
+  unsigned m_cache_gen = 0;
+
+  node * new_node();
+  void free_node(node * p);
+  node * find_or_create_node(const ref & r, node_type type);
 
-  void set_bool(const node_path & path, bool value);
-  void set_int64(const node_path & path, int64_t value);
-  void set_uint64(const node_path & path, uint64_t value);
-  void set_uint128(const node_path & path, uint64_t value_hi, uint64_t value_lo);
-  void set_cstring(const node_path & path, const char * value);
-  void set_string(const node_path & path, const std::string & value);
-  void set_initlist_value(const node_path & path, const initlist_value & value);
+  void set_bool(const ref & r, bool value);
+  void set_int64(const ref & r, int64_t value);
+  void set_uint64(const ref & r, uint64_t value);
+  void set_uint128(const ref & r, uint64_t value_hi, uint64_t value_lo);
+  void set_cstring(const ref & r, const char * value);
+  void set_string(const ref & r, const std::string & value);
+  void set_initlist_value(const ref & r, const initlist_value & value);
 
   static void output_json(output_function & prt, bool pretty, bool sorted, const node * p,
     int level);
+  static void output_json_element(output_function & prt, bool pretty, bool first,
+    const node * p);
   static void output_yaml(output_function & prt, bool pretty, bool sorted, const node * p,
     int level_o, int level_a, bool cont);
+  static void output_cbor(output_function & prt, bool sorted, const node * p);
   static void output_flat(output_function & prt, const char * assign, bool sorted,
     const node * p, std::string & path);
 };
@@ -63,10 +63,17 @@ const char * get_drivedb_path_default();
 #endif
 
 // Read drive database from file.
+// Uses the compiled file "PATH.bin" instead if it is up to date.
 bool read_drive_database(const char * path);
 
+// Write compiled drive database file "PATH.bin" from text file PATH.
+bool compile_drive_database(const char * path);
+
 // Init default db entry and optionally read drive databases from standard places.
-bool init_drive_database(bool use_default_db);
+// If DEFERRED is set, this is done on first use of the database by
+// lookup_drive_apply_presets(), lookup_usb_device(), get_default_attr_defs()
+// or show*presets().  Errors are then only reported.
+bool init_drive_database(bool use_default_db, bool deferred = false);
 
 // Get vendor attribute options from default db entry.
 const ata_vendor_attr_defs & get_default_attr_defs();
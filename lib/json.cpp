@@ -18,6 +18,7 @@
 
 #include <inttypes.h>
 
+#include <algorithm>
 #include <stdexcept>
 
 namespace smartmon {
@@ -85,14 +86,16 @@ json::ref::ref(json & js, const char * keystr)
 }
 
 json::ref::ref(const ref & base, const char * keystr)
-: m_js(base.m_js), m_path(base.m_path)
+: m_js(base.m_js), m_path(base.m_path),
+  m_parent_node(base.find_node()), m_cache_gen(base.m_js.m_cache_gen)
 {
   jassert(keystr && *keystr);
   m_path.push_back(node_info(keystr));
 }
 
 json::ref::ref(const ref & base, int index)
-: m_js(base.m_js), m_path(base.m_path)
+: m_js(base.m_js), m_path(base.m_path),
+  m_parent_node(base.find_node()), m_cache_gen(base.m_js.m_cache_gen)
 {
   jassert(0 <= index && index < 10000); // Limit: large arrays not supported
   m_path.push_back(node_info(index));
@@ -110,25 +113,63 @@ json::ref::ref(const ref & base, const char * /*dummy*/, const char * key_suffix
     break;
   }
   jassert(i >= 0); // Limit: top level element must be an object
+  if (i == n - 1) {
+    // Same parent element
+    m_parent_node = base.m_parent_node;
+    m_cache_gen = base.m_cache_gen;
+  }
 }
 
 json::ref::~ref()
 {
 }
 
+json::node * json::ref::find_node() const
+{
+  if (!m_js.m_enabled)
+    return nullptr;
+  if (m_path.empty())
+    return &m_js.m_root_node;
+  if (m_cache_gen != m_js.m_cache_gen)
+    m_parent_node = m_node = nullptr; // removed by flush()
+  else if (m_node)
+    return m_node;
+
+  // Start at cached parent element if available
+  node * p = m_parent_node;
+  unsigned i = m_path.size() - 1;
+  if (!p) {
+    p = &m_js.m_root_node;
+    i = 0;
+  }
+  for ( ; p && i < m_path.size(); i++) {
+    const node_info & pi = m_path[i];
+    if (!pi.key.empty())
+      p = (p->type == nt_object ? p->find_child(pi.key) : nullptr);
+    else
+      p = (p->type == nt_array && pi.index < (int)p->childs.size()
+           ? p->childs[pi.index] : nullptr);
+  }
+  if (p) {
+    m_node = p;
+    m_cache_gen = m_js.m_cache_gen;
+  }
+  return p;
+}
+
 void json::ref::operator=(bool value)
 {
-  m_js.set_bool(m_path, value);
+  m_js.set_bool(*this, value);
 }
 
 void json::ref::operator=(long long value)
 {
-  m_js.set_int64(m_path, (int64_t)value);
+  m_js.set_int64(*this, (int64_t)value);
 }
 
 void json::ref::operator=(unsigned long long value)
 {
-  m_js.set_uint64(m_path, (uint64_t)value);
+  m_js.set_uint64(*this, (uint64_t)value);
 }
 
 void json::ref::operator=(int value)
@@ -153,12 +194,12 @@ void json::ref::operator=(unsigned long value)
 
 void json::ref::operator=(const char * value)
 {
-  m_js.set_cstring(m_path, value);
+  m_js.set_cstring(*this, value);
 }
 
 void json::ref::operator=(const std::string & value)
 {
-  m_js.set_string(m_path, value);
+  m_js.set_string(*this, value);
 }
 
 void json::ref::set_uint128(uint64_t value_hi, uint64_t value_lo)
@@ -166,7 +207,7 @@ void json::ref::set_uint128(uint64_t value_hi, uint64_t value_lo)
   if (!value_hi)
     operator=((unsigned long long)value_lo);
   else
-    m_js.set_uint128(m_path, value_hi, value_lo);
+    m_js.set_uint128(*this, value_hi, value_lo);
 }
 
 bool json::ref::set_if_safe_uint64(uint64_t value)
@@ -267,29 +308,104 @@ json::node::node()
 {
 }
 
-json::node::node(const std::string & key_)
-: key(key_)
+json::node::~node()
 {
 }
 
-json::node::~node()
+// Objects with more elements use a hash table for key lookup.
+static const unsigned max_linear_search = 8;
+
+// FNV-1a hash
+static unsigned key_hash(const std::string & key)
+{
+  uint32_t h = 0x811c9dc5;
+  for (unsigned i = 0; i < key.size(); i++) {
+    h ^= (unsigned char)key[i];
+    h *= 0x01000193;
+  }
+  return h;
+}
+
+json::node * json::node::find_child(const std::string & key_) const
+{
+  if (key_table.empty()) {
+    for (node * p2 : childs) {
+      if (p2->key == key_)
+        return p2;
+    }
+    return nullptr;
+  }
+
+  unsigned mask = key_table.size() - 1;
+  for (unsigned i = key_hash(key_) & mask; key_table[i]; i = (i + 1) & mask) {
+    node * p2 = childs[key_table[i] - 1];
+    if (p2->key == key_)
+      return p2;
+  }
+  return nullptr;
+}
+
+void json::node::add_child(node * p)
+{
+  childs.push_back(p);
+  unsigned n = childs.size();
+  if (n <= max_linear_search)
+    return;
+
+  // Keep load factor <= 1/2, rehash if table grows
+  unsigned size = key_table.size();
+  unsigned first = n;
+  if (size < 2 * n) {
+    if (!size)
+      size = 4 * max_linear_search;
+    while (size < 2 * n)
+      size *= 2;
+    key_table.assign(size, 0);
+    first = 1;
+  }
+  unsigned mask = size - 1;
+  for (unsigned ci = first; ci <= n; ci++) {
+    unsigned i = key_hash(childs[ci - 1]->key) & mask;
+    while (key_table[i])
+      i = (i + 1) & mask;
+    key_table[i] = ci;
+  }
+}
+
+void json::node::remove_child(unsigned i)
+{
+  jassert(i < childs.size());
+  std::vector<node *> old_childs;
+  old_childs.swap(childs);
+  old_childs.erase(old_childs.begin() + i);
+  key_table.clear();
+  for (node * p : old_childs)
+    add_child(p);
+}
+
+void json::node::reset()
 {
+  type = nt_unset;
+  intval = intval_hi = 0;
+  strval.clear();
+  key.clear();
+  childs.clear();
+  key_table.clear();
 }
 
 json::node::const_iterator::const_iterator(const json::node * node_p, bool sorted)
-: m_node_p(node_p),
-  m_use_map(sorted && node_p->type == nt_object)
+: m_node_p(node_p)
 {
-  if (m_use_map)
-    m_key_iter = node_p->key2index.begin();
+  if (sorted && node_p->type == nt_object) {
+    m_sorted.assign(node_p->childs.begin(), node_p->childs.end());
+    std::sort(m_sorted.begin(), m_sorted.end(),
+      [](const node * a, const node * b) { return (a->key < b->key); });
+  }
 }
 
 bool json::node::const_iterator::at_end() const
 {
-  if (m_use_map)
-    return (m_key_iter == m_node_p->key2index.end());
-  else
-    return (m_child_idx >= m_node_p->childs.size());
+  return (m_child_idx >= m_node_p->childs.size());
 }
 
 unsigned json::node::const_iterator::array_index() const
@@ -300,24 +416,60 @@ unsigned json::node::const_iterator::array_index() const
 
 void json::node::const_iterator::operator++()
 {
-  if (m_use_map)
-    ++m_key_iter;
-  else
-    ++m_child_idx;
+  ++m_child_idx;
 }
 
 const json::node * json::node::const_iterator::operator*() const
 {
-  if (m_use_map)
-    return m_node_p->childs[m_key_iter->second].get();
+  if (!m_sorted.empty())
+    return m_sorted[m_child_idx];
   else
-    return m_node_p->childs[m_child_idx].get();
+    return m_node_p->childs[m_child_idx];
 }
 
-json::node * json::find_or_create_node(const json::node_path & path, node_type type)
+json::node * json::new_node()
 {
+  if (!m_free_nodes.empty()) {
+    node * p = m_free_nodes.back();
+    m_free_nodes.pop_back();
+    return p;
+  }
+  if (m_node_block_used >= node_block_size) {
+    m_node_blocks.push_back(std::unique_ptr<node[]>(new node[node_block_size]));
+    m_node_block_used = 0;
+  }
+  return &m_node_blocks.back()[m_node_block_used++];
+}
+
+void json::free_node(node * p)
+{
+  for (node * p2 : p->childs) {
+    if (p2)
+      free_node(p2);
+  }
+  p->reset();
+  m_free_nodes.push_back(p);
+}
+
+json::node * json::find_or_create_node(const ref & r, node_type type)
+{
+  const node_path & path = r.m_path;
   node * p = &m_root_node;
-  for (unsigned i = 0; i < path.size(); i++) {
+  unsigned i = 0;
+  if (r.m_cache_gen != m_cache_gen)
+    r.m_parent_node = nullptr; // removed by flush()
+  else if (r.m_node) {
+    // Element already exists
+    p = r.m_node;
+    i = path.size();
+  }
+  else if (r.m_parent_node) {
+    // Parent element already exists
+    p = r.m_parent_node;
+    i = path.size() - 1;
+  }
+
+  for ( ; i < path.size(); i++) {
     const node_info & pi = path[i];
     if (!pi.key.empty()) {
       // Object
@@ -326,16 +478,15 @@ json::node * json::find_or_create_node(const json::node_path & path, node_type t
       else
         jassert(p->type == nt_object); // Limit: type change not supported
       // Existing or new object element?
-      node::keymap::iterator ni = p->key2index.find(pi.key);
-      node * p2;
-      if (ni != p->key2index.end()) {
-        // Object element exists
-        p2 = p->childs[ni->second].get();
-      }
-      else {
+      node * p2 = p->find_child(pi.key);
+      if (!p2) {
         // Create new object element
-        p->key2index[pi.key] = (unsigned)p->childs.size();
-        p->childs.push_back(std::unique_ptr<node>(p2 = new node(pi.key)));
+        if (!i && !m_flushed_keys.empty()) // Limit: element already written by flush()
+          jassert(std::find(m_flushed_keys.begin(), m_flushed_keys.end(), pi.key)
+                  == m_flushed_keys.end());
+        p2 = new_node();
+        p2->key = pi.key;
+        p->add_child(p2);
       }
       jassert(p2 && p2->key == pi.key);
       p = p2;
@@ -351,14 +502,14 @@ json::node * json::find_or_create_node(const json::node_path & path, node_type t
       // Existing or new array element?
       if (pi.index < (int)p->childs.size()) {
         // Array index exists
-        p2 = p->childs[pi.index].get();
+        p2 = p->childs[pi.index];
         if (!p2) // Already created ?
-          p->childs[pi.index].reset(p2 = new node);
+          p->childs[pi.index] = p2 = new_node();
       }
       else {
         // Grow array, fill gap, create new element
         p->childs.resize(pi.index + 1);
-        p->childs[pi.index].reset(p2 = new node);
+        p->childs[pi.index] = p2 = new_node();
       }
       jassert(p2 && p2->key.empty());
       p = p2;
@@ -371,59 +522,61 @@ json::node * json::find_or_create_node(const json::node_path & path, node_type t
     p->type = type;
   else
     jassert(p->type == type); // Limit: type change not supported
+  r.m_node = p;
+  r.m_cache_gen = m_cache_gen;
   return p;
 }
 
-void json::set_bool(const node_path & path, bool value)
+void json::set_bool(const ref & r, bool value)
 {
   if (!m_enabled)
     return;
-  find_or_create_node(path, nt_bool)->intval = (value ? 1 : 0);
+  find_or_create_node(r, nt_bool)->intval = (value ? 1 : 0);
 }
 
-void json::set_int64(const node_path & path, int64_t value)
+void json::set_int64(const ref & r, int64_t value)
 {
   if (!m_enabled)
     return;
-  find_or_create_node(path, nt_int)->intval = (uint64_t)value;
+  find_or_create_node(r, nt_int)->intval = (uint64_t)value;
 }
 
-void json::set_uint64(const node_path & path, uint64_t value)
+void json::set_uint64(const ref & r, uint64_t value)
 {
   if (!m_enabled)
     return;
-  find_or_create_node(path, nt_uint)->intval = value;
+  find_or_create_node(r, nt_uint)->intval = value;
 }
 
-void json::set_uint128(const node_path & path, uint64_t value_hi, uint64_t value_lo)
+void json::set_uint128(const ref & r, uint64_t value_hi, uint64_t value_lo)
 {
   if (!m_enabled)
     return;
-  node * p = find_or_create_node(path, nt_uint128);
+  node * p = find_or_create_node(r, nt_uint128);
   p->intval_hi = value_hi;
   p->intval = value_lo;
 }
 
-void json::set_cstring(const node_path & path, const char * value)
+void json::set_cstring(const ref & r, const char * value)
 {
   if (!m_enabled)
     return;
   jassert(value != nullptr); // Limit: nullptr not supported
-  find_or_create_node(path, nt_string)->strval = value;
+  find_or_create_node(r, nt_string)->strval = value;
 }
 
-void json::set_string(const node_path & path, const std::string & value)
+void json::set_string(const ref & r, const std::string & value)
 {
   if (!m_enabled)
     return;
-  find_or_create_node(path, nt_string)->strval = value;
+  find_or_create_node(r, nt_string)->strval = value;
 }
 
-void json::set_initlist_value(const node_path & path, const initlist_value & val)
+void json::set_initlist_value(const ref & r, const initlist_value & val)
 {
   if (!m_enabled)
     return;
-  node * p = find_or_create_node(path, val.type);
+  node * p = find_or_create_node(r, val.type);
   switch (p->type) {
     case nt_bool: case nt_int: case nt_uint: p->intval = val.intval; break;
     case nt_string: p->strval = val.strval; break;
@@ -459,6 +612,12 @@ void json::output_function::format(const char * fmt, ...)
   va_end(ap);
 }
 
+void json::output_function::write(const void * data, unsigned size)
+{
+  jassert(!memchr(data, 0, size)); // Limit: binary output not supported
+  operator()(std::string((const char *)data, size).c_str());
+}
+
 // Return -1 if all UTF-8 sequences are valid, else return index of first invalid char
 static int check_utf8(const char * s)
 {
@@ -756,8 +915,182 @@ void json::output_flat(output_function & out, const char * assign, bool sorted,
   }
 }
 
+// Output CBOR (RFC 8949) data item head with major type and argument.
+static void put_cbor_head(json::output_function & out, unsigned major, uint64_t val)
+{
+  unsigned char buf[9];
+  unsigned n;
+  if (val < 24) {
+    buf[0] = (major << 5) | (unsigned char)val; n = 1;
+  }
+  else if (val <= 0xff) {
+    buf[0] = (major << 5) | 24; buf[1] = (unsigned char)val; n = 2;
+  }
+  else if (val <= 0xffff) {
+    buf[0] = (major << 5) | 25; sg_put_unaligned_be16((uint16_t)val, buf + 1); n = 3;
+  }
+  else if (val <= 0xffffffff) {
+    buf[0] = (major << 5) | 26; sg_put_unaligned_be32((uint32_t)val, buf + 1); n = 5;
+  }
+  else {
+    buf[0] = (major << 5) | 27; sg_put_unaligned_be64(val, buf + 1); n = 9;
+  }
+  out.write(buf, n);
+}
+
+// Output CBOR text string.
+static void put_cbor_text(json::output_function & out, const std::string & str)
+{
+  put_cbor_head(out, 3, str.size());
+  out.write(str.data(), str.size());
+}
+
+// Output CBOR text string with same contents as print_quoted_string().
+static void put_cbor_string(json::output_function & out, const char * s)
+{
+  std::string str;
+  int utf8_rc = -2;
+  for (int i = 0; s[i]; i++) {
+    char c = s[i];
+    if (   (' ' <= c && c <= '~') || c == '\t'
+        || ((c & 0x80) && (utf8_rc >= -1 ? utf8_rc : (utf8_rc = check_utf8(s + i))) == -1))
+      str += c;
+    else {
+      char buf[8];
+      snprintf(buf, sizeof(buf), "\\x%02x", (unsigned char)c);
+      str += buf;
+    }
+  }
+  put_cbor_text(out, str);
+}
+
+void json::output_cbor(output_function & out, bool sorted, const node * p)
+{
+  bool is_obj = (p->type == nt_object);
+  switch (p->type) {
+    case nt_object:
+    case nt_array:
+      // Map or array
+      put_cbor_head(out, (is_obj ? 5 : 4), p->childs.size());
+      for (node::const_iterator it(p, sorted); !it.at_end(); ++it) {
+        const node * p2 = *it;
+        if (!p2) {
+          // Unset element of sparse array
+          jassert(!is_obj);
+          out.write("\xf6", 1); // null
+        }
+        else {
+          jassert(is_obj == !p2->key.empty());
+          if (is_obj)
+            put_cbor_text(out, p2->key);
+          // Recurse
+          output_cbor(out, sorted, p2);
+        }
+      }
+      break;
+
+    case nt_bool:
+      out.write(p->intval ? "\xf5" : "\xf4", 1);
+      break;
+
+    case nt_int:
+      if ((int64_t)p->intval >= 0)
+        put_cbor_head(out, 0, p->intval);
+      else
+        put_cbor_head(out, 1, ~p->intval); // -1 - value
+      break;
+
+    case nt_uint:
+      put_cbor_head(out, 0, p->intval);
+      break;
+
+    case nt_uint128:
+      if (!p->intval_hi)
+        put_cbor_head(out, 0, p->intval);
+      else {
+        // Tag 2: Unsigned bignum, big endian byte string
+        unsigned char buf[16];
+        sg_put_unaligned_be64(p->intval_hi, buf);
+        sg_put_unaligned_be64(p->intval, buf + 8);
+        unsigned i = 0;
+        while (!buf[i])
+          i++;
+        put_cbor_head(out, 6, 2);
+        put_cbor_head(out, 2, sizeof(buf) - i);
+        out.write(buf + i, sizeof(buf) - i);
+      }
+      break;
+
+    case nt_string:
+      put_cbor_string(out, p->strval.c_str());
+      break;
+
+    default: jassert(false);
+  }
+}
+
+// Output one top level element for streaming output.
+void json::output_json_element(output_function & out, bool pretty, bool first, const node * p)
+{
+  out(first ? '{' : ',');
+  if (pretty)
+    out("\n  ");
+  out.format("\"%s\":%s", p->key.c_str(), (pretty ? " " : ""));
+  output_json(out, pretty, false, p, 1);
+}
+
+void json::clear()
+{
+  for (node * p : m_root_node.childs) {
+    if (p)
+      free_node(p);
+  }
+  m_root_node.reset();
+  m_uint128_output = false;
+  m_stream_out = nullptr;
+  m_stream_started = false;
+  m_flushed_keys.clear();
+  m_cache_gen++;
+}
+
+void json::set_streaming(output_function & out, const output_options & options)
+{
+  if (options.sorted || options.format)
+    return;
+  m_stream_out = &out;
+  m_stream_pretty = options.pretty;
+}
+
+void json::flush(const char * keystr)
+{
+  if (!(m_enabled && m_stream_out))
+    return;
+  std::string key = str2key(keystr);
+  std::vector<node *> & childs = m_root_node.childs;
+  for (unsigned i = 0; i < childs.size(); i++) {
+    node * p = childs[i];
+    if (p->key != key)
+      continue;
+    output_json_element(*m_stream_out, m_stream_pretty, !m_stream_started, p);
+    m_stream_started = true;
+    m_flushed_keys.push_back(key);
+    m_root_node.remove_child(i);
+    free_node(p);
+    m_cache_gen++;
+    break;
+  }
+}
+
 void json::output(output_function & out, const output_options & options) const
 {
+  if (m_stream_started) {
+    // Output remaining elements after those written by flush()
+    for (const node * p : m_root_node.childs)
+      output_json_element(out, m_stream_pretty, false, p);
+    out(m_stream_pretty ? "\n}\n" : "}");
+    return;
+  }
+
   if (m_root_node.type == nt_unset)
     return;
   jassert(m_root_node.type == nt_object);
@@ -777,6 +1110,9 @@ void json::output(output_function & out, const output_options & options) const
         output_flat(out, (options.pretty ? " = " : "="), options.sorted, &m_root_node, path);
       }
       break;
+    case 'b':
+      output_cbor(out, options.sorted, &m_root_node);
+      break;
   }
 }
 
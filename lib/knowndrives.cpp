@@ -16,14 +16,22 @@
 #include <smartmon/knowndrives.h>
 #include <smartmon/utility.h>
 
+#include <sys/stat.h>
 #ifdef HAVE_UNISTD_H
 #include <unistd.h>
 #endif
 #ifdef _WIN32
 #include <io.h> // access()
 #endif
+#ifdef HAVE_SYS_MMAN_H
+#include <fcntl.h>
+#include <sys/mman.h>
+#endif
 
+#include <algorithm>
+#include <map>
 #include <stdexcept>
+#include <unordered_map>
 
 namespace smartmon {
 
@@ -45,6 +53,81 @@ const drive_settings builtin_knowndrives[] = {
 const unsigned builtin_knowndrives_size =
   sizeof(builtin_knowndrives) / sizeof(builtin_knowndrives[0]);
 
+/// Read-only view of a file, mmap()ed if supported.
+class file_view
+{
+public:
+  file_view()
+    : m_data(0), m_size(0), m_mapped(false) { }
+
+  ~file_view();
+
+  /// Open and map or read file, return false on error.
+  bool open(const char * path);
+
+  /// Get file contents.
+  const char * data() const
+    { return m_data; }
+
+  /// Get file size.
+  size_t size() const
+    { return m_size; }
+
+private:
+  char * m_data;
+  size_t m_size;
+  bool m_mapped;
+
+  file_view(const file_view &);
+  void operator=(const file_view &);
+};
+
+file_view::~file_view()
+{
+#ifdef HAVE_SYS_MMAN_H
+  if (m_mapped) {
+    munmap(m_data, m_size);
+    return;
+  }
+#endif
+  delete [] m_data;
+}
+
+bool file_view::open(const char * path)
+{
+#ifdef HAVE_SYS_MMAN_H
+  int fd = ::open(path, O_RDONLY);
+  if (fd < 0)
+    return false;
+  struct stat st;
+  if (fstat(fd, &st) || st.st_size <= 0) {
+    ::close(fd);
+    return false;
+  }
+  void * p = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  ::close(fd);
+  if (p == MAP_FAILED)
+    return false;
+  m_data = static_cast<char *>(p); m_size = st.st_size; m_mapped = true;
+  return true;
+
+#else
+  stdio_file f(path, "rb");
+  if (!f)
+    return false;
+  if (fseek(f, 0, SEEK_END))
+    return false;
+  long size = ftell(f);
+  if (size <= 0 || fseek(f, 0, SEEK_SET))
+    return false;
+  std::unique_ptr<char[]> buf(new char[size]);
+  if (fread(buf.get(), 1, size, f) != (size_t)size)
+    return false;
+  m_data = buf.release(); m_size = size;
+  return true;
+#endif
+}
+
 /// Drive database class. Stores custom entries read from file.
 /// Provides transparent access to concatenation of custom and
 /// default table.
@@ -69,9 +152,40 @@ public:
   /// Append new custom entry.
   void push_back(const drive_settings & src);
 
+  /// Append new custom entry without copying the strings.
+  /// The strings must remain valid, see keep_view().
+  void push_back_nocopy(const drive_settings & src)
+    { m_custom_tab.push_back(src); invalidate(); }
+
+  /// Take ownership of file view referenced by entries.
+  void keep_view(std::unique_ptr<file_view> && view)
+    { m_views.push_back(std::move(view)); }
+
   /// Append builtin table.
   void append(const drive_settings * builtin_tab, unsigned builtin_size)
-    { m_builtin_tab = builtin_tab; m_builtin_size = builtin_size; }
+    { m_builtin_tab = builtin_tab; m_builtin_size = builtin_size;
+      invalidate(); }
+
+  /// Return true if model regex of entry i fully matches.
+  bool match_model(unsigned i, const char * model)
+    { return match_regex(2*i, model); }
+
+  /// Return true if firmware regex of entry i fully matches.
+  /// Empty regex is not handled here.
+  bool match_firmware(unsigned i, const char * firmware)
+    { return match_regex(2*i+1, firmware); }
+
+  /// Get indexes of all ATA entries whose model regex may match MODEL,
+  /// in table order.  Uses the literal prefixes of the model regexes.
+  void get_ata_candidates(const char * model, std::vector<unsigned> & idx);
+
+  /// Get indexes of all USB entries whose ID regex may match
+  /// VENDOR_ID:PRODUCT_ID, in table order.
+  void get_usb_candidates(int vendor_id, int product_id, std::vector<unsigned> & idx);
+
+  /// Get indexes of all VERSION entries, in table order.
+  const std::vector<unsigned> & get_version_entries()
+    { build_index(); return m_version_entries; }
 
 private:
   const drive_settings * m_builtin_tab;
@@ -79,15 +193,36 @@ private:
 
   std::vector<drive_settings> m_custom_tab;
   std::vector<char *> m_custom_strings;
+  std::vector< std::unique_ptr<file_view> > m_views;
+
+  // Compiled regexes, two per entry, compiled on first use.
+  std::vector< std::unique_ptr<regular_expression> > m_regex_cache;
+
+  // Index of ATA entries by literal model prefix, built on first use.
+  bool m_index_valid;
+  std::unordered_map< std::string, std::vector<unsigned> > m_prefix_index;
+  std::vector<unsigned> m_version_entries;
+  // Index of USB entries by exact vendor:product ID, by vendor ID if
+  // only the product ID contains wildcards and all others.
+  std::unordered_map< uint32_t, std::vector<unsigned> > m_usb_exact;
+  std::unordered_map< uint32_t, std::vector<unsigned> > m_usb_vendor;
+  std::vector<unsigned> m_usb_other;
 
   const char * copy_string(const char * str);
+  bool match_regex(unsigned ri, const char * str);
+  void build_index();
+  void add_usb_index(const char * regex, unsigned i);
+
+  void invalidate()
+    { m_regex_cache.clear(); m_index_valid = false; }
 
   drive_database(const drive_database &);
   void operator=(const drive_database &);
 };
 
 drive_database::drive_database()
-: m_builtin_tab(0), m_builtin_size(0)
+: m_builtin_tab(0), m_builtin_size(0),
+  m_index_valid(false)
 {
 }
 
@@ -112,6 +247,8 @@ void drive_database::push_back(const drive_settings & src)
   dest.warningmsg     = copy_string(src.warningmsg);
   dest.presets        = copy_string(src.presets);
   m_custom_tab.push_back(dest);
+  // Indexes of builtin entries have changed
+  invalidate();
 }
 
 const char * drive_database::copy_string(const char * src)
@@ -128,10 +265,40 @@ const char * drive_database::copy_string(const char * src)
   return dest;
 }
 
+static bool compile(regular_expression & regex, const char *pattern);
+
+bool drive_database::match_regex(unsigned ri, const char * str)
+{
+  if (m_regex_cache.size() != 2 * size())
+    m_regex_cache.resize(2 * size());
+  std::unique_ptr<regular_expression> & regex = m_regex_cache[ri];
+  if (!regex) {
+    const drive_settings & entry = operator[](ri / 2);
+    regex.reset(new regular_expression);
+    // Compile error is printed only once, regex remains empty()
+    compile(*regex, (!(ri & 1) ? entry.modelregexp : entry.firmwareregexp));
+  }
+  if (regex->empty())
+    return false;
+  return regex->full_match(str);
+}
+
 
 /// The drive database.
 static drive_database knowndrives;
 
+// Deferred init_drive_database() call.
+static bool drivedb_init_pending = false;
+static bool drivedb_init_use_default_db = false;
+
+// Run deferred init_drive_database() call on first use of the database.
+// Errors are reported but the database is used as far as read.
+static void init_drive_database_if_pending()
+{
+  if (drivedb_init_pending)
+    init_drive_database(drivedb_init_use_default_db);
+}
+
 
 enum dbentry_type {
   DBENTRY_VERSION,
@@ -175,6 +342,193 @@ static void parse_version(std::string & dbversion, const char * verstr)
   dbversion.append(verstr + match[i].rm_so, match[i].rm_eo - match[i].rm_so);
 }
 
+// Get the literal prefix of each top level alternative of a regex.
+// An empty prefix is returned if an alternative starts with a special char.
+// Return pointer to the closing ']' of the bracket expression at P,
+// or to the terminating null char if there is none.
+static const char * skip_bracket_expr(const char * p)
+{
+  p++;
+  if (*p == '^')
+    p++;
+  if (*p == ']') // "[]...]" and "[^]...]" contain a literal ']'
+    p++;
+  for ( ; *p && *p != ']'; p++) {
+    // Skip "[:class:]", "[.coll.]" and "[=equiv=]"
+    if (*p == '[' && (p[1] == ':' || p[1] == '.' || p[1] == '=')) {
+      const char end[] = { p[1], ']', 0 };
+      const char * e = strstr(p + 2, end);
+      if (!e)
+        return p + strlen(p);
+      p = e + 1;
+    }
+  }
+  return p;
+}
+
+static void get_literal_prefixes(const char * pattern, std::vector<std::string> & prefixes)
+{
+  prefixes.clear();
+  int depth = 0;
+  bool in_prefix = true;
+  std::string prefix;
+  for (const char * p = pattern; ; p++) {
+    char c = *p;
+    if (!c || (c == '|' && !depth)) {
+      prefixes.push_back(prefix);
+      if (!c)
+        break;
+      prefix.clear(); in_prefix = true;
+      continue;
+    }
+
+    switch (c) {
+      case '?': case '*': case '+': case '{':
+        // Last char is optional or repeated
+        if (in_prefix && !prefix.empty())
+          prefix.erase(prefix.size() - 1);
+        in_prefix = false;
+        break;
+      case '[':
+        p = skip_bracket_expr(p);
+        if (!*p)
+          p--; // Unterminated, end of pattern
+        in_prefix = false;
+        break;
+      case '(':
+        depth++; in_prefix = false;
+        break;
+      case ')':
+        depth--;
+        break;
+      case '\\':
+        if (p[1])
+          p++;
+        in_prefix = false;
+        break;
+      case '.': case '^': case '$': case '|':
+        in_prefix = false;
+        break;
+      default:
+        if (in_prefix)
+          prefix += c;
+    }
+  }
+}
+
+void drive_database::build_index()
+{
+  if (m_index_valid)
+    return;
+  m_prefix_index.clear();
+  m_version_entries.clear();
+  m_usb_exact.clear();
+  m_usb_vendor.clear();
+  m_usb_other.clear();
+
+  std::vector<std::string> prefixes;
+  for (unsigned i = 0; i < size(); i++) {
+    const drive_settings & entry = operator[](i);
+    switch (get_dbentry_type(&entry)) {
+      case DBENTRY_VERSION:
+        m_version_entries.push_back(i);
+        break;
+      case DBENTRY_ATA:
+        get_literal_prefixes(entry.modelregexp, prefixes);
+        for (unsigned j = 0; j < prefixes.size(); j++) {
+          std::vector<unsigned> & idx = m_prefix_index[prefixes[j]];
+          if (idx.empty() || idx.back() != i)
+            idx.push_back(i);
+        }
+        break;
+      case DBENTRY_USB:
+        add_usb_index(entry.modelregexp, i);
+        break;
+      default:
+        break;
+    }
+  }
+  m_index_valid = true;
+}
+
+// Parse "0xVVVV:" or "0xVVVV:0xPPPP" as written by lookup_usb_device().
+// Return number of chars parsed, 0 if none.
+static int parse_usb_id(const char * str, unsigned & vendor_id, unsigned & product_id)
+{
+  int n1 = -1, n2 = -1;
+  sscanf(str, "0x%4x:%n0x%4x%n", &vendor_id, &n1, &product_id, &n2);
+  char buf[16];
+  if (n2 == 13) {
+    snprintf(buf, sizeof(buf), "0x%04x:0x%04x", vendor_id, product_id);
+    if (!strncmp(str, buf, n2))
+      return n2;
+  }
+  if (n1 == 7) {
+    snprintf(buf, sizeof(buf), "0x%04x:", vendor_id);
+    if (!strncmp(str, buf, n1))
+      return n1;
+  }
+  return 0;
+}
+
+void drive_database::add_usb_index(const char * regex, unsigned i)
+{
+  unsigned vendor_id = 0, product_id = 0;
+  if (parse_usb_id(regex, vendor_id, product_id) == 13 && !regex[13]) {
+    m_usb_exact[(vendor_id << 16) | product_id].push_back(i);
+    return;
+  }
+
+  // All alternatives must start with the same literal vendor ID
+  std::vector<std::string> prefixes;
+  get_literal_prefixes(regex, prefixes);
+  unsigned vendor_id_0 = 0;
+  for (unsigned j = 0; j < prefixes.size(); j++) {
+    if (!parse_usb_id(prefixes[j].c_str(), vendor_id, product_id)
+        || (j > 0 && vendor_id != vendor_id_0)) {
+      m_usb_other.push_back(i);
+      return;
+    }
+    vendor_id_0 = vendor_id;
+  }
+  m_usb_vendor[vendor_id_0].push_back(i);
+}
+
+void drive_database::get_usb_candidates(int vendor_id, int product_id,
+                                        std::vector<unsigned> & idx)
+{
+  build_index();
+  idx = m_usb_other;
+  uint32_t key = ((vendor_id & 0xffff) << 16) | (product_id & 0xffff);
+  auto it = m_usb_exact.find(key);
+  if (it != m_usb_exact.end())
+    idx.insert(idx.end(), it->second.begin(), it->second.end());
+  it = m_usb_vendor.find(vendor_id & 0xffff);
+  if (it != m_usb_vendor.end())
+    idx.insert(idx.end(), it->second.begin(), it->second.end());
+  // Restore table order
+  std::sort(idx.begin(), idx.end());
+}
+
+void drive_database::get_ata_candidates(const char * model, std::vector<unsigned> & idx)
+{
+  build_index();
+  idx.clear();
+  // Collect entries of all prefixes of MODEL including ""
+  std::string key;
+  for (size_t len = 0; ; len++) {
+    key.assign(model, len);
+    auto it = m_prefix_index.find(key);
+    if (it != m_prefix_index.end())
+      idx.insert(idx.end(), it->second.begin(), it->second.end());
+    if (!model[len])
+      break;
+  }
+  // Restore table order, an entry may be found via several alternatives
+  std::sort(idx.begin(), idx.end());
+  idx.erase(std::unique(idx.begin(), idx.end()), idx.end());
+}
+
 // Compile regular expression, print message on failure.
 static bool compile(regular_expression & regex, const char *pattern)
 {
@@ -187,15 +541,6 @@ static bool compile(regular_expression & regex, const char *pattern)
   return true;
 }
 
-// Compile & match a regular expression.
-static bool match(const char * pattern, const char * str)
-{
-  regular_expression regex;
-  if (!compile(regex, pattern))
-    return false;
-  return regex.full_match(str);
-}
-
 // Searches knowndrives[] for a drive with the given model number and firmware
 // string.  If either the drive's model or firmware strings are not set by the
 // manufacturer then values of NULL may be used.  Returns the entry of the
@@ -203,39 +548,43 @@ static bool match(const char * pattern, const char * str)
 static const drive_settings * lookup_drive(const char * model, const char * firmware,
   std::string * dbversion = nullptr)
 {
+  init_drive_database_if_pending();
+
   if (!model)
     model = "";
   if (!firmware)
     firmware = "";
 
-  for (unsigned i = 0; i < knowndrives.size(); i++) {
-    dbentry_type t = get_dbentry_type(&knowndrives[i]);
-    // Get version if requested
-    if (t == DBENTRY_VERSION) {
-      if (dbversion)
-        parse_version(*dbversion, knowndrives[i].modelfamily);
-      continue;
-    }
-
-    // Skip DEFAULT and USB entries
-    if (t != DBENTRY_ATA)
-      continue;
+  // Get ATA entries with matching literal model prefix
+  std::vector<unsigned> candidates;
+  knowndrives.get_ata_candidates(model, candidates);
 
+  const drive_settings * found = 0;
+  unsigned found_i = knowndrives.size();
+  for (unsigned ci = 0; ci < candidates.size(); ci++) {
+    unsigned i = candidates[ci];
     // Check whether model matches the regular expression in knowndrives[i].
-    if (!match(knowndrives[i].modelregexp, model))
+    if (!knowndrives.match_model(i, model))
       continue;
 
     // Model matches, now check firmware. "" matches always.
     if (!(  !*knowndrives[i].firmwareregexp
-          || match(knowndrives[i].firmwareregexp, firmware)))
+          || knowndrives.match_firmware(i, firmware)))
       continue;
 
     // Found
-    return &knowndrives[i];
+    found = &knowndrives[i]; found_i = i;
+    break;
   }
 
-  // Not found
-  return 0;
+  // Get version if requested, use last VERSION entry before the match
+  if (dbversion) {
+    const std::vector<unsigned> & versions = knowndrives.get_version_entries();
+    for (unsigned vi = 0; vi < versions.size() && versions[vi] < found_i; vi++)
+      parse_version(*dbversion, knowndrives[versions[vi]].modelfamily);
+  }
+
+  return found;
 }
 
 
@@ -313,6 +662,8 @@ static void parse_usb_names(const char * names, usb_dev_info & info)
 int lookup_usb_device(int vendor_id, int product_id, int bcd_device,
                       usb_dev_info & info, usb_dev_info & info2)
 {
+  init_drive_database_if_pending();
+
   // Format strings to match
   char usb_id_str[16], bcd_dev_str[16];
   snprintf(usb_id_str, sizeof(usb_id_str), "0x%04x:0x%04x", vendor_id, product_id);
@@ -321,16 +672,17 @@ int lookup_usb_device(int vendor_id, int product_id, int bcd_device,
   else
     bcd_dev_str[0] = 0;
 
+  // Get USB entries with matching or wildcard ID
+  std::vector<unsigned> candidates;
+  knowndrives.get_usb_candidates(vendor_id, product_id, candidates);
+
   int found = 0;
-  for (unsigned i = 0; i < knowndrives.size(); i++) {
+  for (unsigned ci = 0; ci < candidates.size(); ci++) {
+    unsigned i = candidates[ci];
     const drive_settings & dbentry = knowndrives[i];
 
-    // Skip drive entries
-    if (get_dbentry_type(&dbentry) != DBENTRY_USB)
-      continue;
-
     // Check whether USB vendor:product ID matches
-    if (!match(dbentry.modelregexp, usb_id_str))
+    if (!knowndrives.match_model(i, usb_id_str))
       continue;
 
     // Parse '-d type'
@@ -342,7 +694,7 @@ int lookup_usb_device(int vendor_id, int product_id, int bcd_device,
     // If two entries with same vendor:product ID have different
     // types, use bcd_device (if provided by OS) to select entry.
     if (  *dbentry.firmwareregexp && *bcd_dev_str
-        && match(dbentry.firmwareregexp, bcd_dev_str)) {
+        && knowndrives.match_firmware(i, bcd_dev_str)) {
       // Exact match including bcd_device
       info = d; found = 1;
       break;
@@ -490,6 +842,8 @@ static int showonepreset(const drive_settings * dbentry)
 // Returns #syntax errors.
 int showallpresets()
 {
+  init_drive_database_if_pending();
+
   // loop over all entries in the knowndrives[] table, printing them
   // out in a nice format
   int errcnt = 0;
@@ -515,14 +869,16 @@ int showallpresets()
 // Returns # matching entries.
 int showmatchingpresets(const char *model, const char *firmware)
 {
+  init_drive_database_if_pending();
+
   int cnt = 0;
   const char * firmwaremsg = (firmware ? firmware : "(any)");
 
   for (unsigned i = 0; i < knowndrives.size(); i++) {
-    if (!match(knowndrives[i].modelregexp, model))
+    if (!knowndrives.match_model(i, model))
       continue;
     if (   firmware && *knowndrives[i].firmwareregexp
-        && !match(knowndrives[i].firmwareregexp, firmware))
+        && !knowndrives.match_firmware(i, firmware))
         continue;
     // Found
     if (++cnt == 1)
@@ -873,9 +1229,115 @@ static bool parse_drive_database(parse_ptr src, drive_database & db, const char
   return ok;
 }
 
+
+/////////////////////////////////////////////////////////////////////////////
+// Compiled drive database files
+
+// Layout of "PATH.bin": Header, entry table with 5 string offsets per
+// entry, string area with null terminated strings.  All values are in
+// host byte order, other byte orders are rejected by the format check.
+struct compiled_drivedb_header
+{
+  char magic[8];          // "SMDRVDB\0"
+  uint32_t format;        // compiled_drivedb_format
+  uint32_t num_entries;
+  uint32_t strings_size;
+  uint32_t checksum;      // Over entry table and string area
+  int64_t src_size;       // Size and mtime of the text file
+  int64_t src_mtime;
+  int64_t src_mtime_nsec; // 0 if not supported
+};
+
+static const char compiled_drivedb_magic[8] = "SMDRVDB";
+static const uint32_t compiled_drivedb_format = 0x00010001;
+
+// Return nanoseconds of the mtime of a file, 0 if not supported.
+static inline int64_t get_mtime_nsec(const struct stat & st)
+{
+#ifdef HAVE_STRUCT_STAT_ST_MTIM_TV_NSEC
+  return st.st_mtim.tv_nsec;
+#else
+  (void)st;
+  return 0;
+#endif
+}
+static const char compiled_drivedb_suffix[] = ".bin";
+
+// FNV-1a hash
+static uint32_t drivedb_checksum(const char * data, size_t size)
+{
+  uint32_t h = 0x811c9dc5;
+  for (size_t i = 0; i < size; i++) {
+    h ^= (unsigned char)data[i];
+    h *= 0x01000193;
+  }
+  return h;
+}
+
+// Read compiled drive database "PATH.bin" if it is up to date.
+// Return false if missing, stale or invalid.
+static bool read_compiled_drive_database(const char * path, drive_database & db)
+{
+  struct stat st;
+  if (stat(path, &st))
+    return false;
+
+  std::unique_ptr<file_view> view(new file_view);
+  if (!view->open((std::string(path) + compiled_drivedb_suffix).c_str()))
+    return false;
+
+  const size_t hsize = sizeof(compiled_drivedb_header);
+  compiled_drivedb_header hdr;
+  if (view->size() < hsize)
+    return false;
+  memcpy(&hdr, view->data(), hsize);
+  if (!(   !memcmp(hdr.magic, compiled_drivedb_magic, sizeof(hdr.magic))
+        && hdr.format == compiled_drivedb_format
+        && hdr.src_size == (int64_t)st.st_size
+        && hdr.src_mtime == (int64_t)st.st_mtime
+        && hdr.src_mtime_nsec == get_mtime_nsec(st)))
+    return false; // Unknown format or stale
+
+  const size_t tsize = (size_t)hdr.num_entries * 5 * sizeof(uint32_t);
+  if (!(   hdr.num_entries < 0x100000 && hdr.strings_size > 0
+        && view->size() == hsize + tsize + hdr.strings_size))
+    return false;
+  const char * table = view->data() + hsize;
+  const char * strings = table + tsize;
+  if (!(   strings[hdr.strings_size - 1] == 0
+        && drivedb_checksum(table, tsize + hdr.strings_size) == hdr.checksum))
+    return false;
+
+  // Check all offsets before adding any entries
+  std::vector<drive_settings> entries(hdr.num_entries);
+  for (unsigned i = 0; i < hdr.num_entries; i++) {
+    uint32_t offs[5];
+    memcpy(offs, table + i * sizeof(offs), sizeof(offs));
+    for (int j = 0; j < 5; j++) {
+      if (offs[j] >= hdr.strings_size)
+        return false;
+    }
+    drive_settings & entry = entries[i];
+    entry.modelfamily    = strings + offs[0];
+    entry.modelregexp    = strings + offs[1];
+    entry.firmwareregexp = strings + offs[2];
+    entry.warningmsg     = strings + offs[3];
+    entry.presets        = strings + offs[4];
+  }
+
+  for (unsigned i = 0; i < entries.size(); i++)
+    db.push_back_nocopy(entries[i]);
+  db.keep_view(std::move(view));
+  return true;
+}
+
 // Read drive database from file.
 bool read_drive_database(const char * path)
 {
+  // Use compiled file if up to date
+  if (read_compiled_drive_database(path, knowndrives))
+    return true;
+
   stdio_file f(path, "r"
 #ifdef __CYGWIN__ // Allow files with '\r\n'.
                       "t"
@@ -889,6 +1351,85 @@ bool read_drive_database(const char * path)
   return parse_drive_database(parse_ptr(f), knowndrives, path);
 }
 
+// Write compiled drive database file "PATH.bin" from text file PATH.
+bool compile_drive_database(const char * path)
+{
+  struct stat st;
+  stdio_file f(path, "r"
+#ifdef __CYGWIN__ // Allow files with '\r\n'.
+                      "t"
+#endif
+                         );
+  if (!f || fstat(fileno(f), &st)) {
+    lib_printf("%s: cannot open drive database file\n", path);
+    return false;
+  }
+
+  drive_database db;
+  if (!parse_drive_database(parse_ptr(f), db, path))
+    return false;
+  f.close();
+
+  // Create entry table and string area, merge duplicate strings
+  std::vector<uint32_t> table;
+  std::string strings;
+  std::map<std::string, uint32_t> string_offs;
+  for (unsigned i = 0; i < db.size(); i++) {
+    const drive_settings & entry = db[i];
+    const char * const values[5] = {
+      entry.modelfamily, entry.modelregexp, entry.firmwareregexp,
+      entry.warningmsg, entry.presets
+    };
+    for (int j = 0; j < 5; j++) {
+      auto ins = string_offs.insert(std::make_pair(std::string(values[j]),
+                                                   (uint32_t)strings.size()));
+      if (ins.second)
+        strings.append(values[j], strlen(values[j]) + 1);
+      table.push_back(ins.first->second);
+    }
+  }
+  if (strings.empty())
+    strings += '\0';
+
+  std::string data(reinterpret_cast<const char *>(table.data()),
+                   table.size() * sizeof(uint32_t));
+  data += strings;
+
+  compiled_drivedb_header hdr;
+  memset(&hdr, 0, sizeof(hdr));
+  memcpy(hdr.magic, compiled_drivedb_magic, sizeof(hdr.magic));
+  hdr.format = compiled_drivedb_format;
+  hdr.num_entries = db.size();
+  hdr.strings_size = strings.size();
+  hdr.checksum = drivedb_checksum(data.data(), data.size());
+  hdr.src_size = st.st_size;
+  hdr.src_mtime = st.st_mtime;
+  hdr.src_mtime_nsec = get_mtime_nsec(st);
+
+  // Write to temp file and rename
+  std::string outpath = std::string(path) + compiled_drivedb_suffix;
+  std::string tmppath = outpath + ".tmp";
+  stdio_file out(tmppath.c_str(), "wb");
+  if (!out) {
+    lib_printf("%s: cannot create file\n", tmppath.c_str());
+    return false;
+  }
+  bool ok = (   fwrite(&hdr, sizeof(hdr), 1, out) == 1
+             && fwrite(data.data(), data.size(), 1, out) == 1);
+  if (!out.close())
+    ok = false;
+#ifdef _WIN32
+  if (ok)
+    unlink(outpath.c_str()); // rename() does not replace existing file
+#endif
+  if (!(ok && !rename(tmppath.c_str(), outpath.c_str()))) {
+    lib_printf("%s: write error\n", outpath.c_str());
+    unlink(tmppath.c_str());
+    return false;
+  }
+  return true;
+}
+
 // Get path for additional database file
 const char * get_drivedb_path_add()
 {
@@ -980,8 +1521,15 @@ static bool init_default_attr_defs()
 }
 
 // Init default db entry and optionally read drive databases from standard places.
-bool init_drive_database(bool use_default_db)
+bool init_drive_database(bool use_default_db, bool deferred /* = false */)
 {
+  if (deferred) {
+    drivedb_init_pending = true;
+    drivedb_init_use_default_db = use_default_db;
+    return true;
+  }
+  drivedb_init_pending = false;
+
   if (use_default_db && !read_default_drive_databases())
     return false;
 
@@ -991,6 +1539,7 @@ bool init_drive_database(bool use_default_db)
 // Get vendor attribute options from default db entry.
 const ata_vendor_attr_defs & get_default_attr_defs()
 {
+  init_drive_database_if_pending();
   return default_attr_defs;
 }
 
@@ -81,7 +81,14 @@
 #include "dev_ata_cmd_set.h"
 #include "dev_areca.h"
 
+#include <atomic>
+#include <exception>
+#include <map>
 #include <set>
+#include <system_error>
+#ifdef HAVE_STD_THREAD
+#include <thread>
+#endif
 
 // "include/uapi/linux/nvme_ioctl.h" from Linux kernel sources
 #include "linux_nvme_ioctl.h" // nvme_passthru_cmd, NVME_IOCTL_ADMIN_CMD
@@ -134,6 +141,7 @@ private:
   int m_flags; ///< Flags for ::open()
   int m_retry_flags; ///< Flags to retry ::open(), -1 if no retry
   bool m_enable_is_powered_down; ///< Enable sysfs runtime power management check
+  std::string m_power_dir; ///< Sysfs runtime power management dir, empty if not yet known
 };
 
 linux_smart_device::~linux_smart_device()
@@ -217,10 +225,262 @@ static bool read_sysfs_line(const char * dev_name, const char * sysfs_path,
   return true;
 }
 
+/////////////////////////////////////////////////////////////////////////////
+/// Sysfs device topology
+
+// Info about a block or SCSI generic device from sysfs
+struct sysfs_dev_info
+{
+  std::string name;          ///< Basename: "sda", "sg3", "nvme0n1", ...
+  std::string syspath;       ///< "/sys/devices/..." path of the device
+  std::string power_dir;     ///< Runtime power management dir, empty if not available
+  std::string transport;     ///< "usb", "ata", "nvme", "scsi" or empty if unknown
+  int host = -1, channel = -1, target = -1, lun = -1; ///< SCSI address, -1 if none
+  int scsi_type = -1;        ///< SCSI peripheral device type, -1 if none
+  bool is_sg = false;        ///< Found in "/sys/class/scsi_generic"
+  bool has_driver = false;   ///< SCSI upper level driver attached
+  std::string vendor, model; ///< SCSI INQUIRY vendor and product
+  std::string proc_name;     ///< SCSI host driver name ("ahci", "hpsa", ...)
+  std::string raid_level;    ///< HPSA logical drive RAID level
+  std::string power_control, runtime_status; ///< Runtime power management state
+  bool usb_id_found = false;
+  unsigned short usb_vendor_id = 0, usb_product_id = 0, usb_version = 0;
+};
+
+// Devices from "/sys/block" and "/sys/class/scsi_generic"
+class sysfs_topology
+{
+public:
+  /// Walk "/sys/block" and "/sys/class/scsi_generic" once
+  /// and replace the current contents.
+  void scan();
+
+  /// Remove all devices.
+  void clear()
+    { m_devs.clear(); }
+
+  /// Find device by basename, nullptr if not found.
+  const sysfs_dev_info * find(const char * name) const;
+
+  /// Read info of a single device without a full scan.
+  static bool read_dev(const char * name, sysfs_dev_info & info);
+
+private:
+  std::map<std::string, sysfs_dev_info> m_devs;
+};
+
+// Topology read by scan_smart_devices(), empty outside of a scan.
+// Later device names may refer to other devices, so single devices
+// are then read again with sysfs_topology::read_dev().
+static sysfs_topology sysfs_devs;
+
+// Read first line of sysfs file NAME relative to DIRFD,
+// strip trailing white space.
+static bool sysfs_read_at(int dirfd, const char * name, std::string & value)
+{
+  int fd = openat(dirfd, name, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return false;
+  char buf[256];
+  ssize_t n = read(fd, buf, sizeof(buf) - 1);
+  ::close(fd);
+  if (n < 0)
+    return false;
+  buf[n] = 0;
+  n = strcspn(buf, "\n");
+  while (n > 0 && buf[n - 1] == ' ')
+    n--;
+  value.assign(buf, n);
+  return true;
+}
+
+// Read 4 digit hex USB ID from sysfs file NAME relative to DIRFD
+static bool sysfs_read_id_at(int dirfd, const char * name, unsigned short & id)
+{
+  std::string value;
+  if (!sysfs_read_at(dirfd, name, value))
+    return false;
+  int n = -1;
+  return (sscanf(value.c_str(), "%hx%n", &id, &n) == 1 && n == 4 && value.size() == 4);
+}
+
+// Read info of device NAME from class directory CLASSFD.  Search for USB
+// bridge IDs stops at the directory with inode STOP_INO ("/sys/devices").
+static bool sysfs_read_dev_at(int classfd, const char * classdir, const char * name,
+  ino_t stop_ino, std::map<int, std::string> & proc_names, sysfs_dev_info & info)
+{
+  // Skip virtual devices (loop, dm, md, ...)
+  std::string devdir = strprintf("%s/device", name);
+  int devfd = openat(classfd, devdir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (devfd < 0)
+    return false;
+
+  info.name = name;
+  info.is_sg = !strcmp(classdir, "/sys/class/scsi_generic");
+
+  // "/sys/block/sda" -> "../devices/pci0000:00/.../0:0:0:0/block/sda"
+  char link[512];
+  ssize_t n = readlinkat(classfd, name, link, sizeof(link) - 1);
+  if (0 < n && n < (ssize_t)sizeof(link) - 1) {
+    link[n] = 0;
+    const char * p = link;
+    while (str_starts_with(p, "../"))
+      p += 3;
+    info.syspath = strprintf("/sys/%s", p);
+  }
+  else
+    info.syspath = strprintf("%s/%s", classdir, name);
+
+  // "/sys/block/sda/device" -> "../../../0:0:0:0"
+  n = readlinkat(classfd, devdir.c_str(), link, sizeof(link) - 1);
+  if (0 < n && n < (ssize_t)sizeof(link) - 1) {
+    link[n] = 0;
+    const char * p = strrchr(link, '/');
+    int h = -1, c = -1, t = -1, l = -1, nc = -1;
+    if (   sscanf((p ? p + 1 : link), "%d:%d:%d:%d%n", &h, &c, &t, &l, &nc) == 4
+        && nc == (int)strlen(p ? p + 1 : link)) {
+      info.host = h; info.channel = c; info.target = t; info.lun = l;
+    }
+  }
+
+  std::string value;
+  if (sysfs_read_at(devfd, "type", value) && !value.empty()
+      && strspn(value.c_str(), "0123456789") == value.size())
+    info.scsi_type = atoi(value.c_str());
+  sysfs_read_at(devfd, "vendor", info.vendor);
+  sysfs_read_at(devfd, "model", info.model);
+  sysfs_read_at(devfd, "raid_level", info.raid_level);
+  info.has_driver = !faccessat(devfd, "driver", R_OK, 0);
+
+  if (sysfs_read_at(devfd, "power/control", info.power_control)) {
+    info.power_dir = strprintf("%s/%s/device/power", classdir, name);
+    sysfs_read_at(devfd, "power/runtime_status", info.runtime_status);
+  }
+
+  if (info.host >= 0) {
+    auto it = proc_names.find(info.host);
+    if (it == proc_names.end()) {
+      std::string hostdir = strprintf("/sys/class/scsi_host/host%d/proc_name", info.host);
+      std::string proc_name;
+      sysfs_read_at(AT_FDCWD, hostdir.c_str(), proc_name);
+      it = proc_names.emplace(info.host, proc_name).first;
+    }
+    info.proc_name = it->second;
+  }
+
+  // Search in parent directories of "sdX" or "sgN" until "idVendor" is
+  // found, fail if "/sys/devices" reached or too many iterations
+  if (name[0] == 's' && (name[1] == 'd' || name[1] == 'g')) {
+    int fd = devfd;
+    for (int cnt = 1; cnt < 10; cnt++) {
+      int parentfd = openat(fd, "..", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+      if (fd != devfd)
+        ::close(fd);
+      fd = parentfd;
+      struct stat st;
+      if (fd < 0 || fstat(fd, &st) || st.st_ino == stop_ino)
+        break;
+      if (faccessat(fd, "idVendor", F_OK, 0))
+        continue;
+
+      if (scsi_debugmode > 1)
+        lib_printf("Found idVendor %d level(s) above: %s/%s\n", cnt, classdir, devdir.c_str());
+      info.usb_id_found = (   sysfs_read_id_at(fd, "idVendor", info.usb_vendor_id)
+                           && sysfs_read_id_at(fd, "idProduct", info.usb_product_id)
+                           && sysfs_read_id_at(fd, "bcdDevice", info.usb_version)   );
+      if (info.usb_id_found && scsi_debugmode > 1)
+        lib_printf("USB ID = 0x%04x:0x%04x (0x%03x)\n", info.usb_vendor_id,
+                   info.usb_product_id, info.usb_version);
+      break;
+    }
+    if (fd >= 0 && fd != devfd)
+      ::close(fd);
+  }
+  ::close(devfd);
+
+  if (info.usb_id_found)
+    info.transport = "usb";
+  else if (info.syspath.find("/ata") != std::string::npos)
+    info.transport = "ata";
+  else if (info.syspath.find("/nvme") != std::string::npos)
+    info.transport = "nvme";
+  else if (info.host >= 0)
+    info.transport = "scsi";
+  return true;
+}
+
+// Return inode of "/sys/devices", 0 if not found
+static ino_t sysfs_devices_ino()
+{
+  struct stat st;
+  return (!stat("/sys/devices", &st) ? st.st_ino : 0);
+}
+
+static const char * const sysfs_class_dirs[] = {
+  "/sys/block", "/sys/class/scsi_generic"
+};
+
+void sysfs_topology::scan()
+{
+  m_devs.clear();
+  ino_t stop_ino = sysfs_devices_ino();
+  std::map<int, std::string> proc_names;
+
+  for (const char * classdir : sysfs_class_dirs) {
+    DIR * dp = opendir(classdir);
+    if (!dp)
+      continue;
+    int classfd = dirfd(dp);
+    while (const struct dirent * d = readdir(dp)) {
+      if (d->d_name[0] == '.')
+        continue;
+      sysfs_dev_info info;
+      if (!sysfs_read_dev_at(classfd, classdir, d->d_name, stop_ino, proc_names, info))
+        continue;
+      if (scsi_debugmode > 1)
+        lib_printf("%s/%s: [%d:%d:%d:%d] %s, type %d, \"%s\" \"%s\", host \"%s\"%s%s\n",
+          classdir, info.name.c_str(), info.host, info.channel, info.target, info.lun,
+          (!info.transport.empty() ? info.transport.c_str() : "-"), info.scsi_type,
+          info.vendor.c_str(), info.model.c_str(), info.proc_name.c_str(),
+          (info.has_driver ? ", driver" : ""),
+          (!info.runtime_status.empty() ? (", " + info.runtime_status).c_str() : ""));
+      m_devs[info.name] = std::move(info);
+    }
+    closedir(dp);
+  }
+}
+
+const sysfs_dev_info * sysfs_topology::find(const char * name) const
+{
+  auto it = m_devs.find(name);
+  return (it != m_devs.end() ? &it->second : nullptr);
+}
+
+bool sysfs_topology::read_dev(const char * name, sysfs_dev_info & info)
+{
+  if (!*name || strchr(name, '/') || name[0] == '.')
+    return false;
+  ino_t stop_ino = sysfs_devices_ino();
+  std::map<int, std::string> proc_names;
+
+  // Try block device first, then SCSI generic device
+  for (const char * classdir : sysfs_class_dirs) {
+    int classfd = open(classdir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (classfd < 0)
+      continue;
+    bool ok = sysfs_read_dev_at(classfd, classdir, name, stop_ino, proc_names, info);
+    ::close(classfd);
+    if (ok)
+      return true;
+  }
+  return false;
+}
+
 // Query OS if device is powered up or down using sysfs runtime power management.
 // Check /sys/block/sdX/device/power/control for "auto" mode, then
 // check /sys/block/sdX/device/power/runtime_status for "suspend*" status.
 // Fallback includes "hidden" SCSI generic devices.
+// The sysfs directory is located once via the topology from the last scan.
 // Returns true if the device is suspended, false in any other case.
 bool linux_smart_device::is_powered_down()
 {
@@ -231,43 +491,52 @@ bool linux_smart_device::is_powered_down()
     return false;
   }
 
-  // Resolve symlinks to get the actual device path
-  unique_malloced_ptr<char[]> resolved_path(realpath(get_dev_name(), nullptr));
-  if (!resolved_path) {
-    lib_printf("Device: %s, cannot resolve device path: %s\n",
-               get_dev_name(), strerror(errno));
-    return false;
-  }
-
-  // Extract basename from the resolved path
-  const char * dev_base = strrchr(resolved_path.get(), '/');
-  if (!dev_base) {
-    lib_printf("Device: %s, invalid resolved path (no /): %s\n",
-               get_dev_name(), resolved_path.get());
-    return false;
-  }
-  dev_base++;  // Skip past the '/'
-
-  // Validate device name is a simple basename without path components
-  if (strchr(dev_base, '/')) {
-    lib_printf("Device: %s, invalid device name format after resolution: %s\n",
-               get_dev_name(), resolved_path.get());
-    return false;
-  }
+  if (m_power_dir.empty()) {
+    // Resolve symlinks to get the actual device path
+    unique_malloced_ptr<char[]> resolved_path(realpath(get_dev_name(), nullptr));
+    if (!resolved_path) {
+      lib_printf("Device: %s, cannot resolve device path: %s\n",
+                 get_dev_name(), strerror(errno));
+      return false;
+    }
 
-  char sysfs_path[128], buffer[64];
+    // Extract basename from the resolved path
+    const char * dev_base = strrchr(resolved_path.get(), '/');
+    if (!dev_base) {
+      lib_printf("Device: %s, invalid resolved path (no /): %s\n",
+                 get_dev_name(), resolved_path.get());
+      return false;
+    }
+    dev_base++;  // Skip past the '/'
 
-  // Try block device path first (handles sd, nvme, etc.)
-  snprintf(sysfs_path, sizeof(sysfs_path), "/sys/block/%s/device/power/control", dev_base);
+    // Validate device name is a simple basename without path components
+    if (strchr(dev_base, '/')) {
+      lib_printf("Device: %s, invalid device name format after resolution: %s\n",
+                 get_dev_name(), resolved_path.get());
+      return false;
+    }
 
-  // Fallback to SCSI generic path (handles hidden sg devices without sd attachment)
-  if (access(sysfs_path, R_OK) != 0) {
-    snprintf(sysfs_path, sizeof(sysfs_path), "/sys/class/scsi_generic/%s/device/power/control", dev_base);
+    // Use info from current scan if available
+    sysfs_dev_info info;
+    const sysfs_dev_info * infop = sysfs_devs.find(dev_base);
+    if (!infop && sysfs_topology::read_dev(dev_base, info))
+      infop = &info;
+    if (!(infop && !infop->power_dir.empty())) {
+      // Runtime power management not available for this device
+      if (debug)
+        lib_printf("Device: %s, runtime power management not available\n", get_dev_name());
+      return false;
+    }
+    m_power_dir = infop->power_dir;
   }
 
+  char buffer[64];
+
   // Read power control file
-  if (!read_sysfs_line(get_dev_name(), sysfs_path, buffer, sizeof(buffer))) {
-    // Runtime power management not available for this device
+  if (!read_sysfs_line(get_dev_name(), (m_power_dir + "/control").c_str(),
+                       buffer, sizeof(buffer))) {
+    // Device may have been removed, locate again on next call
+    m_power_dir.clear();
     if (debug)
       lib_printf("Device: %s, runtime power management not available\n", get_dev_name());
     return false;
@@ -281,16 +550,9 @@ bool linux_smart_device::is_powered_down()
     return false;
   }
 
-  // Try block device path first (handles sd, nvme, etc.)
-  snprintf(sysfs_path, sizeof(sysfs_path), "/sys/block/%s/device/power/runtime_status", dev_base);
-
-  // Fallback to SCSI generic path (handles hidden sg devices without sd attachment)
-  if (access(sysfs_path, R_OK) != 0) {
-    snprintf(sysfs_path, sizeof(sysfs_path), "/sys/class/scsi_generic/%s/device/power/runtime_status", dev_base);
-  }
-
   // Read runtime status file
-  if (!read_sysfs_line(get_dev_name(), sysfs_path, buffer, sizeof(buffer))) {
+  if (!read_sysfs_line(get_dev_name(), (m_power_dir + "/runtime_status").c_str(),
+                       buffer, sizeof(buffer))) {
     // Runtime status not available
     if (debug)
       lib_printf("Device: %s, runtime power management status not available\n", get_dev_name());
@@ -628,7 +890,8 @@ enum lk_sg_io_ifc_t {
     SG_IO_USE_V4 = 4,
 };
 
-static enum lk_sg_io_ifc_t sg_io_interface = SG_IO_USE_DETECT;
+// Atomic because devices may be checked or probed in parallel
+static std::atomic<lk_sg_io_ifc_t> sg_io_interface(SG_IO_USE_DETECT);
 
 
 /* Preferred implementation for issuing SCSI commands in linux. This
@@ -905,7 +1168,7 @@ static int do_normal_scsi_cmnd_io(int dev_fd, struct scsi_cmnd_io * iop,
         return sg_io_cmnd_io(dev_fd, iop, report, sg_io_interface);
     default:
         lib_printf(">>>> do_scsi_cmnd_io: bad sg_io_interface=%d\n",
-             (int)sg_io_interface);
+             (int)sg_io_interface.load());
         sg_io_interface = SG_IO_USE_DETECT;
         return -EIO;    /* report error and reset state */
     }
@@ -928,8 +1191,13 @@ public:
 
   virtual bool scsi_pass_through(scsi_cmnd_io * iop) override;
 
+  /// Skip autodetection on next open, type was already detected.
+  void set_probed()
+    { m_probed = true; }
+
 private:
   bool m_scanning; ///< true if created within scan_smart_devices
+  bool m_probed = false; ///< true if autodetection was done during scan
 };
 
 linux_scsi_device::linux_scsi_device(smart_interface * intf,
@@ -2720,6 +2988,10 @@ smart_device * linux_scsi_device::autodetect_open()
   if (!open())
     return this;
 
+  // No Autodetection if already done by scan_smart_devices()
+  if (m_probed)
+    return this;
+
   // No Autodetection if device type was specified by user
   bool sat_only = false;
   if (*get_req_type()) {
@@ -2868,72 +3140,6 @@ bool linux_nvme_device::nvme_pass_through(const nvme_cmd_in & in, nvme_cmd_out &
 }
 
 
-//////////////////////////////////////////////////////////////////////
-// USB bridge ID detection
-
-// Read USB ID from /sys file
-static bool read_id(const std::string & path, unsigned short & id)
-{
-  FILE * f = fopen(path.c_str(), "r");
-  if (!f)
-    return false;
-  int n = -1;
-  bool ok = (fscanf(f, "%hx%n", &id, &n) == 1 && n == 4);
-  fclose(f);
-  return ok;
-}
-
-// Get USB bridge ID for "sdX" or "sgN"
-static bool get_usb_id(const char * name, unsigned short & vendor_id,
-                       unsigned short & product_id, unsigned short & version)
-{
-  // Only "sdX" or "sgN" supported
-  if (!(name[0] == 's' && (name[1] == 'd' || name[1] == 'g') && !strchr(name, '/')))
-    return false;
-
-  // Start search at dir referenced by symlink
-  // "/sys/block/sdX/device" or
-  // "/sys/class/scsi_generic/sgN"
-  // -> "/sys/devices/.../usb*/.../host*/target*/..."
-  std::string dir = strprintf("/sys/%s/%s%s",
-    (name[1] == 'd' ? "block" : "class/scsi_generic"), name,
-    (name[1] == 'd' ? "/device" : ""));
-
-  // Stop search at "/sys/devices"
-  struct stat st;
-  if (stat("/sys/devices", &st))
-    return false;
-  ino_t stop_ino = st.st_ino;
-
-  // Search in parent directories until "idVendor" is found,
-  // fail if "/sys/devices" reached or too many iterations
-  int cnt = 0;
-  do {
-    dir += "/..";
-    if (!(++cnt < 10 && !stat(dir.c_str(), &st) && st.st_ino != stop_ino))
-      return false;
-  } while (access((dir + "/idVendor").c_str(), 0));
-
-  if (scsi_debugmode > 1) {
-    lib_printf("Found idVendor in: %s\n", dir.c_str());
-    char * p = realpath(dir.c_str(), (char *)0);
-    if (p) {
-      lib_printf("         realpath: %s\n", p);
-      free(p);
-    }
-  }
-
-  // Read IDs
-  if (!(   read_id(dir + "/idVendor", vendor_id)
-        && read_id(dir + "/idProduct", product_id)
-        && read_id(dir + "/bcdDevice", version)   ))
-    return false;
-
-  if (scsi_debugmode > 1)
-    lib_printf("USB ID = 0x%04x:0x%04x (0x%03x)\n", vendor_id, product_id, version);
-  return true;
-}
-
 //////////////////////////////////////////////////////////////////////
 /// Linux interface
 
@@ -3071,21 +3277,19 @@ void linux_smart_interface::get_dev_list(smart_device_list & devlist,
     // Skip sg devices unless they are disks with no upper level driver bound.
     // These are RAID physical disks on some drivers (e.g. mptsas/mpt3sas).
     if (mi == 7) {
-      std::string devdir = "/sys/class/scsi_generic/" + key + "/device/";
-
-      stdio_file ftype((devdir + "type").c_str(), "r");
+      const sysfs_dev_info * info = sysfs_devs.find(key.c_str());
       // Sysfs not mounted or path is not a SCSI device?
-      if (!ftype)
+      if (!(info && info->scsi_type >= 0))
         continue;
 
-      if (fgetc(ftype) != '0' || fgetc(ftype) != '\n') {
+      if (info->scsi_type != 0) {
         if (scsi_debugmode)
           lib_printf("%s, %s: Ignoring: not a disk\n", name, key.c_str());
         continue;
       }
 
       // Ignore as duplicate if the device has a driver attached
-      if (!access((devdir + "driver").c_str(), R_OK)) {
+      if (info->has_driver) {
         if (scsi_debugmode)
           lib_printf("%s, %s: Ignoring: has an upper level driver (scan as disk)\n", name, key.c_str());
         continue;
@@ -3093,14 +3297,10 @@ void linux_smart_interface::get_dev_list(smart_device_list & devlist,
 
       // Ignore "Universal Xport" devices, as they show up as disks but are
       // masked out in the kernel (see drivers/scsi/scsi_devinfo.c)
-      stdio_file fmodel((devdir + "model").c_str(), "r");
-      if (fmodel) {
-        char model[256];
-        if (fgets(model, sizeof(model), fmodel) && !strncmp(model, "Universal Xport", 15)) {
-          if (scsi_debugmode)
-            lib_printf("%s, %s: Ignoring: Universal Xport device\n", name, key.c_str());
-          continue;
-        }
+      if (str_starts_with(info->model, "Universal Xport")) {
+        if (scsi_debugmode)
+          lib_printf("%s, %s: Ignoring: Universal Xport device\n", name, key.c_str());
+        continue;
       }
     }
 
@@ -3239,6 +3439,112 @@ bool linux_smart_interface::get_dev_sssraid(smart_device_list & devlist)
   return true;
 }
 
+#ifdef HAVE_STD_THREAD
+// Output buffer of the device probed by the current thread, if any
+static thread_local std::string * probe_output = nullptr;
+
+// Hook which collects lib_printf() output of probe workers, because the
+// application hook may not be thread safe.
+class probe_output_hook : public lib_global_hook
+{
+public:
+  probe_output_hook()
+    : m_prev(lib_global_hook::get())
+    { lib_global_hook::set(*this); }
+
+  ~probe_output_hook()
+    { lib_global_hook::set(m_prev); }
+
+  virtual void lib_vprintf(const char * fmt, va_list ap) override
+    {
+      if (probe_output)
+        probe_output->append(vstrprintf(fmt, ap));
+      else
+        m_prev.lib_vprintf(fmt, ap);
+    }
+
+private:
+  lib_global_hook & m_prev;
+};
+#endif
+
+// Open and identify all devices of DEVLIST using up to NUM_THREADS threads.
+// Each device is replaced by the result of autodetect_open() at the same
+// list position, so the order does not depend on the completion order.
+// Messages are printed in list order after all devices are probed.
+static void probe_devices(smart_device_list & devlist, unsigned num_threads)
+{
+  std::vector<smart_device *> devs(devlist.size());
+  for (unsigned i = 0; i < devs.size(); i++)
+    devs[i] = devlist.release(i);
+  devlist.clear();
+  std::vector<std::string> outputs(devs.size());
+
+  std::atomic<unsigned> next(0);
+  std::exception_ptr exc;
+  std::atomic<bool> failed(false);
+  auto worker = [&]() {
+    try {
+      for (unsigned i; !failed && (i = next++) < devs.size(); ) {
+        smart_device * dev = devs[i];
+        bool was_scsi = !!dynamic_cast<linux_scsi_device *>(dev);
+#ifdef HAVE_STD_THREAD
+        probe_output = &outputs[i];
+#endif
+        devs[i] = dev = dev->autodetect_open();
+#ifdef HAVE_STD_THREAD
+        probe_output = nullptr;
+#endif
+        if (!dev->is_open())
+          continue;
+        dev->close();
+        // Keep plain SCSI result, INQUIRY already done
+        linux_scsi_device * scsidev = dynamic_cast<linux_scsi_device *>(dev);
+        if (was_scsi && scsidev)
+          scsidev->set_probed();
+      }
+    }
+    catch (...) {
+#ifdef HAVE_STD_THREAD
+      probe_output = nullptr;
+#endif
+      if (!failed.exchange(true))
+        exc = std::current_exception();
+    }
+  };
+
+#ifdef HAVE_STD_THREAD
+  {
+    probe_output_hook hook;
+    // Main thread is also used as a worker
+    std::vector<std::thread> threads;
+    for (unsigned i = 1; i < num_threads && i < devs.size(); i++) {
+      try {
+        threads.push_back(std::thread(worker));
+      }
+      catch (const std::system_error &) {
+        break; // Use fewer threads
+      }
+    }
+    worker();
+    for (std::thread & t : threads)
+      t.join();
+  }
+  for (const std::string & out : outputs) {
+    if (!out.empty())
+      lib_printf("%s", out.c_str());
+  }
+#else
+  (void)num_threads;
+  worker();
+#endif
+
+  for (smart_device * dev : devs)
+    devlist.push_back(dev);
+  if (exc)
+    std::rethrow_exception(exc);
+}
+
 bool linux_smart_interface::scan_smart_devices(smart_device_list & devlist,
   const smart_devtype_list & types, const char * pattern /*= 0*/)
 {
@@ -3249,10 +3555,18 @@ bool linux_smart_interface::scan_smart_devices(smart_device_list & devlist,
   bool by_id = false, scan_megaraid = false, scan_sssraid = false, scan_sg = false;
   const char * type_ata = nullptr, * type_scsi = nullptr, * type_sat = nullptr;
   const char * type_nvme = nullptr;
+  unsigned probe_threads = 0;
   for (unsigned i = 0; i < types.size(); i++) {
     const char * type = types[i].c_str();
+    int n = -1;
     if (!strcmp(type, "by-id"))
       by_id = true;
+    else if (!strncmp(type, "probe", 5) && (!type[5] || type[5] == ',')) {
+      probe_threads = 8;
+      if (type[5] && !(   sscanf(type + 6, "%u%n", &probe_threads, &n) == 1
+                       && n == (int)strlen(type + 6) && 0 < probe_threads && probe_threads <= 64))
+        return set_err(EINVAL, "Invalid number of threads in '%s', valid range is 1-64", type);
+    }
     else if (!strcmp(type, "ata"))
       type_ata = "ata";
     else if (!strcmp(type, "scsi"))
@@ -3270,7 +3584,7 @@ bool linux_smart_interface::scan_smart_devices(smart_device_list & devlist,
     else
       return set_err(EINVAL,
                      "Invalid type '%s', valid arguments are:"
-                     " by-id, ata, scsi, sat, sg, nvme, megaraid, sssraid",
+                     " by-id, probe[,N], ata, scsi, sat, sg, nvme, megaraid, sssraid",
                      type);
   }
   // Use default if no type specified
@@ -3282,31 +3596,47 @@ bool linux_smart_interface::scan_smart_devices(smart_device_list & devlist,
   const char * type_scsi_sat = ((type_scsi && type_sat) ? "" // detect both
                                 : (type_scsi ? type_scsi : type_sat));
 
+  // Read sysfs once for all devices, clear on return
+  sysfs_devs.scan();
+  struct sysfs_devs_clear {
+    ~sysfs_devs_clear() { sysfs_devs.clear(); }
+  } sysfs_devs_clear_on_return;
+
+  smart_device_list scanned;
   std::set<std::string> devs_seen;
   if (by_id)
     // Scan unique symlinks first
-    get_dev_list(devlist, "/dev/disk/by-id/*", true, devs_seen, type_scsi_sat, type_nvme);
+    get_dev_list(scanned, "/dev/disk/by-id/*", true, devs_seen, type_scsi_sat, type_nvme);
 
   if (type_ata) // TODO: Remove?
-    get_dev_list(devlist, "/dev/hd[a-t]", false, devs_seen, nullptr, nullptr, type_ata);
+    get_dev_list(scanned, "/dev/hd[a-t]", false, devs_seen, nullptr, nullptr, type_ata);
 
   if (type_scsi_sat) {
-    get_dev_list(devlist, "/dev/sd[a-z]", false, devs_seen, type_scsi_sat, nullptr);
-    get_dev_list(devlist, "/dev/sd[a-z][a-z]", false, devs_seen, type_scsi_sat, nullptr);
+    get_dev_list(scanned, "/dev/sd[a-z]", false, devs_seen, type_scsi_sat, nullptr);
+    get_dev_list(scanned, "/dev/sd[a-z][a-z]", false, devs_seen, type_scsi_sat, nullptr);
   }
 
   if (scan_sg) {
     if (!type_scsi_sat)
       type_scsi_sat = ""; // detect both
-    get_dev_list(devlist, "/dev/sg[0-9]", false, devs_seen, type_scsi_sat, nullptr);
-    get_dev_list(devlist, "/dev/sg[0-9][0-9]", false, devs_seen, type_scsi_sat, nullptr);
-    get_dev_list(devlist, "/dev/sg[0-9][0-9][0-9]", false, devs_seen, type_scsi_sat, nullptr);
+    get_dev_list(scanned, "/dev/sg[0-9]", false, devs_seen, type_scsi_sat, nullptr);
+    get_dev_list(scanned, "/dev/sg[0-9][0-9]", false, devs_seen, type_scsi_sat, nullptr);
+    get_dev_list(scanned, "/dev/sg[0-9][0-9][0-9]", false, devs_seen, type_scsi_sat, nullptr);
   }
 
   if (type_nvme) {
-    get_dev_list(devlist, "/dev/nvme[0-9]", false, devs_seen, nullptr, type_nvme);
-    get_dev_list(devlist, "/dev/nvme[1-9][0-9]", false, devs_seen, nullptr, type_nvme);
+    get_dev_list(scanned, "/dev/nvme[0-9]", false, devs_seen, nullptr, type_nvme);
+    get_dev_list(scanned, "/dev/nvme[1-9][0-9]", false, devs_seen, nullptr, type_nvme);
+  }
+
+  // Open and identify devices in parallel if requested,
+  // sequentially if debug output is enabled
+  if (probe_threads) {
+    if (ata_debugmode || scsi_debugmode || nvme_debugmode)
+      probe_threads = 1;
+    probe_devices(scanned, probe_threads);
   }
+  devlist.append(scanned);
 
   if (scan_megaraid)
     get_dev_megasas(devlist);
@@ -3537,63 +3867,15 @@ static unsigned get_kernel_release()
 }
 
 // Check for SCSI host proc_name "hpsa" and HPSA raid_level
-static bool is_hpsa_in_raid_mode(const char * name)
+static bool is_hpsa_in_raid_mode(const sysfs_dev_info & info)
 {
-  char path[128];
-  snprintf(path, sizeof(path), "/sys/block/%s/device", name);
-  char * syshostpath = realpath(path, (char *)0);
-  if (!syshostpath)
-    return false;
-
-  char * syshost = strrchr(syshostpath, '/');
-  if (!syshost) {
-    free(syshostpath);
-    return false;
-  }
-
-  char * hostsep = strchr(++syshost, ':');
-  if (hostsep)
-    *hostsep = 0;
-
-  snprintf(path, sizeof(path), "/sys/class/scsi_host/host%s/proc_name", syshost);
-  free(syshostpath);
-  int fd = open(path, O_RDONLY);
-  if (fd < 0)
-    return false;
-
-  char proc_name[32];
-  ssize_t n = read(fd, proc_name, sizeof(proc_name) - 1);
-  close(fd);
-  if (n < 4)
-    return false;
-
-  proc_name[n] = 0;
-  if (proc_name[n - 1] == '\n')
-    proc_name[n - 1] = 0;
-
-  if (scsi_debugmode > 1)
-    lib_printf("%s -> %s: \"%s\"\n", name, path, proc_name);
-
-  if (strcmp(proc_name, "hpsa"))
+  if (info.is_sg || info.proc_name != "hpsa")
     return false;
 
   // See: https://git.kernel.org/pub/scm/linux/kernel/git/torvalds/linux.git/tree/drivers/scsi/hpsa.c?id=6417f03132a6952cd17ddd8eaddbac92b61b17e0#n693
-  snprintf(path, sizeof(path), "/sys/block/%s/device/raid_level", name);
-  fd = open(path, O_RDONLY);
-  if (fd < 0)
-    return false;
-
-  char raid_level[4];
-  n = read(fd, raid_level, sizeof(raid_level) - 1);
-  close(fd);
-  if (n < 3)
-    return false;
-  raid_level[n] = 0;
-
-  if (strcmp(raid_level, "N/A"))
-    return true;
-
-  return false;
+  if (scsi_debugmode > 1)
+    lib_printf("%s: hpsa raid_level \"%s\"\n", info.name.c_str(), info.raid_level.c_str());
+  return (info.raid_level.size() >= 3 && info.raid_level != "N/A");
 }
 
 // Guess device type (ata or scsi) based on device name (Linux
@@ -3630,11 +3912,19 @@ smart_device * linux_smart_interface::autodetect_smart_device(const char * name)
 
   // form /dev/s* or s*
   if (str_starts_with(test_name, "s")) {
+    // Use sysfs info from current scan if available
+    sysfs_dev_info info;
+    const sysfs_dev_info * infop = nullptr;
+    if ((test_name[1] == 'd' || test_name[1] == 'g') && !strchr(test_name, '/')) {
+      infop = sysfs_devs.find(test_name);
+      if (!infop && sysfs_topology::read_dev(test_name, info))
+        infop = &info;
+    }
 
     // Try to detect possible USB->(S)ATA bridge
-    unsigned short vendor_id = 0, product_id = 0, version = 0;
-    if (get_usb_id(test_name, vendor_id, product_id, version)) {
-      const char * usbtype = get_usb_dev_type_by_id(vendor_id, product_id, version);
+    if (infop && infop->usb_id_found) {
+      const char * usbtype = get_usb_dev_type_by_id(infop->usb_vendor_id,
+        infop->usb_product_id, infop->usb_version);
       if (!usbtype)
         return nullptr;
 
@@ -3649,7 +3939,7 @@ smart_device * linux_smart_interface::autodetect_smart_device(const char * name)
     }
 
     // Fail if hpsa driver and device is using RAID
-    if (is_hpsa_in_raid_mode(test_name))
+    if (infop && is_hpsa_in_raid_mode(*infop))
       return missing_option("-d cciss,N");
 
     // No USB bridge or hpsa driver found, assume regular SCSI device
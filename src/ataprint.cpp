@@ -4580,6 +4580,7 @@ int ataPrintMain (ata_device * device, const ata_print_options & options)
       pout("Pending Defects log (GP Log 0x0c) not supported\n\n");
     else if (!print_pending_defects_log(device, nsectors, options.pending_defects_log))
       failuretest(OPTIONAL_CMD, returnval|=FAILSMART);
+    jglb.flush("ata_pending_defects_log");
   }
 
   // Print SATA Phy Event Counters
@@ -4639,6 +4640,7 @@ int ataPrintMain (ata_device * device, const ata_print_options & options)
       farm_supported = false;
     }
     jglb["seagate_farm_log"]["supported"] = farm_supported;
+    jglb.flush("seagate_farm_log");
   }
 
   // Suggest '-x' if '-a' is specified without any advanced option
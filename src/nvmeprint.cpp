@@ -884,6 +884,7 @@ int nvmePrintMain(nvme_device * device, const nvme_print_options & options)
              want_entries - read_entries, device->get_errmsg());
 
       print_error_log(error_log, read_entries, max_entries);
+      jglb.flush("nvme_error_information_log");
     }
   }
 
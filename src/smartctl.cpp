@@ -27,6 +27,11 @@
 #include <unistd.h>
 #endif
 
+#ifdef _WIN32
+#include <fcntl.h> // _O_BINARY
+#include <io.h> // _setmode()
+#endif
+
 #if defined(__FreeBSD__)
 #include <sys/param.h>
 #endif
@@ -53,9 +58,22 @@ json jglb;
 static bool print_as_json = false;
 static json::output_options print_as_json_options;
 static bool print_as_json_output = false;
+static bool print_as_json_stream = false;
 static bool print_as_json_impl = false;
 static bool print_as_json_unimpl = false;
 
+// JSON output to stdout
+class json_stdout_output : public json::output_function
+{
+public:
+  virtual void operator()(const char * str) override
+    { fputs(str, stdout); }
+  virtual void write(const void * data, unsigned size) override
+    { fwrite(data, 1, size, stdout); }
+};
+
+static json_stdout_output json_stdout;
+
 static void printslogan()
 {
   jout("%s\n", format_version_info("smartctl").c_str());
@@ -144,7 +162,7 @@ static void Usage()
   );
   pout(
 "================================== SMARTCTL RUN-TIME BEHAVIOR OPTIONS =====\n\n"
-"  -j, --json[=cgiosuvy]\n"
+"  -j, --json[=bcfgiosuvy]\n"
 "         Print output in JSON or YAML format\n\n"
 "  -q TYPE, --quietmode=TYPE                                           (ATA)\n"
 "         Set smartctl quiet mode to one of: errorsonly, silent, noserial\n\n"
@@ -213,6 +231,8 @@ static void Usage()
 #endif
   pout(
          "]\n\n"
+"  --drivedb-compile=FILE                                              (ATA)\n"
+"        Write compiled drive database FILE.bin from FILE and exit\n\n"
 "============================================ DEVICE SELF-TEST OPTIONS =====\n\n"
 "  -t TEST, --test=TEST\n"
 "        Run test. TEST: offline, short, long, conveyance, force, vendor,N,\n"
@@ -228,7 +248,8 @@ static void Usage()
 }
 
 // Values for  --long only options, see parse_options()
-enum { opt_identify = 1000, opt_scan, opt_scan_open, opt_set, opt_smart };
+enum { opt_identify = 1000, opt_scan, opt_scan_open, opt_set, opt_smart,
+       opt_drivedb_compile };
 
 /* Returns a string containing a formatted list of the valid arguments
    to the option opt or empty on failure. Note 'v' case different */
@@ -280,7 +301,7 @@ static std::string getvalidarglist(int opt)
   case 's':
     return getvalidarglist(opt_smart)+", "+getvalidarglist(opt_set);
   case 'j':
-    return "c, g, i, o, s, u, v, y";
+    return "b, c, f, g, i, o, s, u, v, y";
   case opt_identify:
     return "n, wn, w, v, wv, wb";
   case 'v':
@@ -355,6 +376,7 @@ static int parse_options(int argc, char** argv, const char * & type,
     { "firmwarebug",     required_argument, 0, 'F' },
     { "nocheck",         required_argument, 0, 'n' },
     { "drivedb",         required_argument, 0, 'B' },
+    { "drivedb-compile", required_argument, 0, opt_drivedb_compile },
     { "format",          required_argument, 0, 'f' },
     { "get",             required_argument, 0, 'g' },
     { "json",            optional_argument, 0, 'j' },
@@ -962,6 +984,10 @@ static int parse_options(int argc, char** argv, const char * & type,
           return FAILCMD;
       }
       break;
+    case opt_drivedb_compile:
+      if (!compile_drive_database(optarg))
+        return FAILCMD;
+      return 0;
     case 'h':
       printing_is_off = false;
       printslogan();
@@ -1152,12 +1178,15 @@ static int parse_options(int argc, char** argv, const char * & type,
         print_as_json_options.sorted = false;
         print_as_json_options.format = 0;
         print_as_json_output = false;
+        print_as_json_stream = false;
         print_as_json_impl = print_as_json_unimpl = false;
         bool json_verbose = false;
         if (optarg_is_set) {
           for (int i = 0; optarg[i]; i++) {
             switch (optarg[i]) {
+              case 'b': print_as_json_options.format = 'b'; break;
               case 'c': print_as_json_options.pretty = false; break;
+              case 'f': print_as_json_stream = true; break;
               case 'g': print_as_json_options.format = 'g'; break;
               case 'i': print_as_json_impl = true; break;
               case 'o': print_as_json_output = true; break;
@@ -1233,8 +1262,8 @@ static int parse_options(int argc, char** argv, const char * & type,
 
   // Special handling of --scan, --scanopen
   if (scan) {
-    // Read or init drive database to allow USB ID check.
-    if (!init_drive_database(use_default_db))
+    // Read or init drive database on first USB ID check.
+    if (!init_drive_database(use_default_db, true /* deferred */))
       return FAILCMD;
     scan_devices(scan_types, (scan == opt_scan_open), argv + optind);
     return 0;
@@ -1320,8 +1349,9 @@ static int parse_options(int argc, char** argv, const char * & type,
     return FAILCMD;
   }
 
-  // Read or init drive database
-  if (!init_drive_database(use_default_db))
+  // Read or init drive database on first use.
+  // Not needed for e.g. SCSI and NVMe devices.
+  if (!init_drive_database(use_default_db, true /* deferred */))
     return FAILCMD;
 
   // No error, continue in main_worker()
@@ -1637,6 +1667,16 @@ static int main_worker(int argc, char **argv)
       return status;
   }
 
+#ifdef _WIN32
+  // CBOR output is binary, prevent LF -> CR/LF conversion
+  if (print_as_json && print_as_json_options.format == 'b')
+    _setmode(_fileno(stdout), _O_BINARY);
+#endif
+
+  // Output large JSON sections as soon as complete, see json::flush()
+  if (print_as_json_stream)
+    jglb.set_streaming(json_stdout, print_as_json_options);
+
   // Store formatted current time for jout_startup_datetime()
   // Output as JSON regardless of '-i' option
   {
@@ -1742,7 +1782,7 @@ int main(int argc, char **argv)
     if (jglb.has_uint128_output())
       jglb["smartctl"]["uint128_precision_bits"] = uint128_to_str_precision_bits();
     jglb["smartctl"]["exit_status"] = status;
-    jglb.output([](const char * str){ fputs(str, stdout); }, nullptr, print_as_json_options);
+    jglb.output(json_stdout, print_as_json_options);
   }
   catch (const std::bad_alloc & /*ex*/) {
     // Memory allocation failed (also thrown by std::operator new)
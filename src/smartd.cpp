@@ -29,11 +29,24 @@
 #include <getopt.h>
 
 #include <algorithm> // std::replace()
+#include <atomic>
+#include <functional>
 #include <map>
+#include <memory>
+#include <set>
 #include <stdexcept>
 #include <string>
 #include <vector>
 
+#ifdef HAVE_STD_THREAD
+#include <chrono>
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <system_error>
+#include <thread>
+#endif
+
 // conditionally included files
 #ifndef _WIN32
 #include <sys/wait.h>
@@ -67,6 +80,13 @@ typedef int pid_t;
 #include <systemd/sd-daemon.h>
 #endif // HAVE_LIBSYSTEMD
 
+#ifdef __linux__
+#include <glob.h>
+#include <linux/netlink.h>
+#include <poll.h>
+#include <sys/socket.h>
+#endif // __linux__
+
 // locally included files
 #include <smartmon/atacmds.h>
 #include <smartmon/dev_interface.h>
@@ -141,6 +161,12 @@ static constexpr int default_checktime = 1800;
 static int checktime = default_checktime;
 static int checktime_min = 0; // Minimum individual check time, 0 if none
 
+// command-line: staggering of device checks
+enum stagger_t {
+  STAGGER_OFF, STAGGER_ON, STAGGER_CONTROLLER
+};
+static stagger_t stagger = STAGGER_OFF;
+
 // command-line: name of PID file (empty for no pid file)
 static std::string pid_file;
 
@@ -151,6 +177,10 @@ static std::string state_path_prefix
 #endif
                                     ;
 
+// command-line: write all persistent states to a single journal file
+// 'PREFIXjournal' instead of one file per device
+static bool state_journal_enabled = false;
+
 // command-line: path prefix of attribute log file, empty if no logs.
 static std::string attrlog_path_prefix
 #ifdef SMARTMONTOOLS_ATTRIBUTELOG
@@ -158,6 +188,22 @@ static std::string attrlog_path_prefix
 #endif
                                     ;
 
+// command-line: format of attribute log file: 0: CSV, 'b': binary
+static char attrlog_format = 0;
+
+// Return file name extension of attribute log file.
+static const char * attrlog_ext()
+{
+  return (attrlog_format == 'b' ? "bin" : "csv");
+}
+
+// command-line: binary attribute log file to print and column, time range
+static std::string attrlog_extract_file, attrlog_extract_name;
+static time_t attrlog_extract_from = 0, attrlog_extract_to = 0;
+
+// command-line: state file to print, empty if none.
+static std::string state_extract_file;
+
 // command-line: path prefix of JSON state file, empty if no JSON output.
 static std::string json_state_path_prefix
 #ifdef SMARTMONTOOLS_JSONSTATE
@@ -165,6 +211,29 @@ static std::string json_state_path_prefix
 #endif
                                         ;
 
+// command-line: format of JSON state file: 0: JSON, 'b': CBOR
+static char json_state_format = 0;
+
+// command-line: sync JSON state files and their directory
+static bool json_state_sync = false;
+
+// command-line: path of JSON snapshot file with all devices, empty if none.
+static std::string json_snapshot_path;
+
+// command-line: path of device scan cache file, empty if none.
+static std::string scan_cache_path;
+
+#ifdef __linux__
+// command-line: uevent source for hotplug events ("netlink" or FIFO), empty if none.
+static std::string uevent_source_name;
+#endif
+
+// Return file name extension of JSON state file.
+static const char * json_state_ext()
+{
+  return (json_state_format == 'b' ? "cbor" : "json");
+}
+
 // configuration file name
 static const char * configfile;
 // configuration file "name" if read from stdin
@@ -217,6 +286,25 @@ static volatile int caughtsigHUP=0;
 // set to signal value if we catch INT, QUIT, or TERM
 static volatile int caughtsigEXIT=0;
 
+// command-line: max number of devices checked in parallel
+static int parallel_checks = 1;
+
+#ifdef HAVE_POSIX_API
+// command-line: max number of warning scripts run in background processes
+// (0 = run synchronously) and their timeout in seconds
+static int warn_async_max = 0;
+static int warn_async_timeout = 300;
+
+// command-line: group warnings raised within this number of seconds
+// into one run of the warning script (0 = disabled)
+static int warn_digest_window = 0;
+#endif
+
+// Output and warning emails from device checks in worker threads are
+// deferred and replayed by the main thread, see CheckDevicesParallel().
+typedef std::vector< std::function<void()> > deferred_call_list;
+static thread_local deferred_call_list * deferred_calls = nullptr;
+
 // This function prints either to stdout or to the syslog as needed.
 static void PrintOut(int priority, const char *fmt, ...)
   SMARTMON_FORMAT_PRINTF(2, 3);
@@ -369,6 +457,28 @@ private:
 };
 
 
+/// ':NNN[-LLL]' offset and limit of scheduled self-tests.
+struct test_offset_limit
+{
+  unsigned offset, limit;
+};
+
+// Cache of test_regex matches, shared by all devices with the same
+// '-s REGEXP', see get_test_hour_mask().  Entries are set only once
+// to the same value, so relaxed access from parallel checks is safe.
+class test_hour_mask_table
+{
+public:
+  explicit test_hour_mask_table(unsigned size)
+    : m_masks(new std::atomic<uint32_t>[size]()) { }
+
+  std::atomic<uint32_t> & operator[](unsigned i)
+    { return m_masks[i]; }
+
+private:
+  std::unique_ptr<std::atomic<uint32_t>[]> m_masks;
+};
+
 /// Configuration data for a device. Read from smartd.conf.
 /// Supports copy & assignment and is compatible with STL containers.
 struct dev_config
@@ -413,7 +523,14 @@ struct dev_config
   unsigned char tempdiff{};               // Track Temperature changes >= this limit
   unsigned char tempinfo{}, tempcrit{};   // Track Temperatures >= these limits as LOG_INFO, LOG_CRIT+mail
   regular_expression test_regex;          // Regex for scheduled testing
+  std::vector<test_offset_limit> test_offsets; // ':NNN[-LLL]' found in test_regex, [0] == {0, 0}
+  std::shared_ptr<test_hour_mask_table> test_hour_masks; // Matches of test_regex, shared
   unsigned test_offset_factor{};          // Factor for staggering of scheduled tests
+  int check_offset{};                     // Offset of staggered check times (seconds)
+  std::string unique_name;                // Device name with symlinks resolved, for hotplug events and reload
+  bool scanned{};                         // Registered from DEVICESCAN
+  std::string directives;                 // DEFAULT and device lines from smartd.conf, for reload
+  std::string dev_ident;                  // Identity from get_device_ident(), for scan cache and reload
 
   // Configuration of email warning messages
   std::string emailcmdline;               // script to execute, empty if no messages
@@ -517,7 +634,7 @@ struct temp_dev_state
   bool must_write{};                      // true if persistent part should be written
 
   bool skip{};                            // skip during next check cycle
-  time_t wakeuptime{};                    // next wakeup time, 0 if unknown or global
+  time_t wakeuptime{};                    // next check time, 0 if unknown
 
   bool not_cap_offline{};                 // true == not capable of offline testing
   bool not_cap_conveyance{};
@@ -537,6 +654,8 @@ struct temp_dev_state
   int lastpowermodeskipped{};             // the last power mode that was skipped
 
   bool json_dirty{};                      // set when current state contains data fresh from this cycle, cleared after JSON write
+  bool json_fresh{};                      // set when current state contains data fresh from this cycle, cleared after JSON snapshot
+  time_t json_update_time{};              // time of last fresh data in JSON snapshot, 0 if none
   bool ata_attr_refreshed{};              // state.smartval refreshed this cycle (ATA only)
   bool ata_errorlog_refreshed{};          // state.ataerrorcount refreshed this cycle (ATA only)
   bool selftest_log_refreshed{};          // state.selflogcount/selfloghour refreshed this cycle (any protocol)
@@ -631,133 +750,206 @@ void dev_state::update_temp_state()
   }
 }
 
+/// Single file journal of the persistent states of all devices.
+/// A commit appends a batch of states, each as a "[NAME]" line followed
+/// by the lines of the state file format.  The batch ends with a
+/// "[commit SIZE HASH]" line.  Batches without valid commit line (e.g.
+/// due to a crash during write) are ignored when the journal is read.
+/// If the journal grows too large, the states of all registered devices
+/// are written to a new file which then replaces the journal.
+class state_journal
+{
+public:
+  const char * path() const
+    { return m_path.c_str(); }
+
+  // Return state lines of device NAME, nullptr if not found.
+  const std::string * find(const std::string & name);
+
+  // Set state lines of device NAME, written on next commit.
+  void add(const std::string & name, std::string && text);
+
+  // Append all states added since last commit to the journal.
+  // If the journal is rewritten, only the states in REGISTERED are kept.
+  bool commit(const std::set<std::string> & registered);
+
+private:
+  std::string m_path;
+  bool m_loaded = false;
+  std::map<std::string, std::string> m_states; // Current state lines
+  std::vector<std::string> m_pending;          // Names of added states
+  uint64_t m_size = 0;                         // Size of journal, 0 forces rewrite
+
+  void load();
+  static bool write(const char * path, const char * mode, const std::string & data);
+};
+
+// Keys of state file lines, see state_file_keys[] below.
+enum state_file_key {
+  SK_TEMPMIN, SK_TEMPMAX, SK_SELFLOGCOUNT, SK_SELFLOGHOUR, SK_TEST_NEXT_CHECK,
+  SK_SELECTIVE_START, SK_SELECTIVE_END, SK_ATAERRORCOUNT,
+  SK_MAIL_COUNT, SK_MAIL_FIRSTSENT, SK_MAIL_LASTSENT,
+  SK_ATTR_ID, SK_ATTR_VAL, SK_ATTR_WORST, SK_ATTR_RAW, SK_ATTR_RESVD,
+  SK_NVME_ERR_LOG_ENTRIES, SK_NVME_AVAIL_SPARE, SK_NVME_PERCENT_USED, SK_NVME_MEDIA_ERRORS
+};
+
+// Keys are "NAME" or "PREFIX.INDEX.NAME".
+static const struct {
+  const char * prefix, * name;
+  state_file_key key;
+} state_file_keys[] = {
+  { nullptr, "temperature-min", SK_TEMPMIN },
+  { nullptr, "temperature-max", SK_TEMPMAX },
+  { nullptr, "self-test-errors", SK_SELFLOGCOUNT },
+  { nullptr, "self-test-last-err-hour", SK_SELFLOGHOUR },
+  { nullptr, "scheduled-test-next-check", SK_TEST_NEXT_CHECK },
+  { nullptr, "selective-test-last-start", SK_SELECTIVE_START },
+  { nullptr, "selective-test-last-end", SK_SELECTIVE_END },
+  { nullptr, "ata-error-count", SK_ATAERRORCOUNT },
+  { "mail", "count", SK_MAIL_COUNT },
+  { "mail", "first-sent-time", SK_MAIL_FIRSTSENT },
+  { "mail", "last-sent-time", SK_MAIL_LASTSENT },
+  { "ata-smart-attribute", "id", SK_ATTR_ID },
+  { "ata-smart-attribute", "val", SK_ATTR_VAL },
+  { "ata-smart-attribute", "worst", SK_ATTR_WORST },
+  { "ata-smart-attribute", "raw", SK_ATTR_RAW },
+  { "ata-smart-attribute", "resvd", SK_ATTR_RESVD },
+  { nullptr, "nvme-err-log-entries", SK_NVME_ERR_LOG_ENTRIES },
+  { nullptr, "nvme-available-spare", SK_NVME_AVAIL_SPARE },
+  { nullptr, "nvme-percentage-used", SK_NVME_PERCENT_USED },
+  { nullptr, "nvme-media-errors", SK_NVME_MEDIA_ERRORS },
+};
+
+// Return true if S[0..LEN) is equal to string T.
+static inline bool str_equal(const char * s, size_t len, const char * t)
+{
+  return (!strncmp(s, t, len) && !t[len]);
+}
+
 // Parse a line from a state file.
+// Format: "^ *KEY *= *[0-9]+[ \n]*$"
 static bool parse_dev_state_line(const char * line, persistent_dev_state & state)
 {
-  static const regular_expression regex(
-    "^ *"
-     "((temperature-min)" // (1 (2)
-     "|(temperature-max)" // (3)
-     "|(self-test-errors)" // (4)
-     "|(self-test-last-err-hour)" // (5)
-     "|(scheduled-test-next-check)" // (6)
-     "|(selective-test-last-start)" // (7)
-     "|(selective-test-last-end)" // (8)
-     "|(ata-error-count)"  // (9)
-     "|(mail\\.([0-9]+)\\." // (10 (11)
-       "((count)" // (12 (13)
-       "|(first-sent-time)" // (14)
-       "|(last-sent-time)" // (15)
-       ")" // 12)
-      ")" // 10)
-     "|(ata-smart-attribute\\.([0-9]+)\\." // (16 (17)
-       "((id)" // (18 (19)
-       "|(val)" // (20)
-       "|(worst)" // (21)
-       "|(raw)" // (22)
-       "|(resvd)" // (23)
-       ")" // 18)
-      ")" // 16)
-     "|(nvme-err-log-entries)" // (24)
-     "|(nvme-available-spare)" // (25)
-     "|(nvme-percentage-used)" // (26)
-     "|(nvme-media-errors)" // (27)
-     ")" // 1)
-     " *= *([0-9]+)[ \n]*$" // (28)
-  );
+  const char * p = line + strspn(line, " ");
+
+  // KEY: "NAME" or "PREFIX.INDEX.NAME"
+  const char * prefix = nullptr, * name = p;
+  size_t prefix_len = 0, name_len = strcspn(p, " =.");
+  unsigned index = 0;
+  p += name_len;
+  if (*p == '.') {
+    prefix = name; prefix_len = name_len;
+    size_t n = strspn(++p, "0123456789");
+    if (!n || p[n] != '.')
+      return false;
+    for (size_t i = 0; i < n; i++) {
+      if (index < 1000) // Out of range, avoid overflow
+        index = index * 10 + (p[i] - '0');
+    }
+    name = (p += n + 1);
+    name_len = strcspn(p, " =");
+    p += name_len;
+  }
 
-  constexpr int nmatch = 1+28;
-  regular_expression::match_range match[nmatch];
-  if (!regex.execute(line, match))
+  // " *= *[0-9]+[ \n]*$"
+  p += strspn(p, " ");
+  if (*p != '=')
     return false;
-  if (match[nmatch-1].rm_so < 0)
+  p += 1 + strspn(p + 1, " ");
+  size_t n = strspn(p, "0123456789");
+  if (!n || p[n + strspn(p + n, " \n")])
     return false;
+  uint64_t val = strtoull(p, (char **)0, 10);
 
-  uint64_t val = strtoull(line + match[nmatch-1].rm_so, (char **)0, 10);
-
-  int m = 1;
-  if (match[++m].rm_so >= 0)
-    state.tempmin = (unsigned char)val;
-  else if (match[++m].rm_so >= 0)
-    state.tempmax = (unsigned char)val;
-  else if (match[++m].rm_so >= 0)
-    state.selflogcount = (unsigned char)val;
-  else if (match[++m].rm_so >= 0)
-    state.selfloghour = val;
-  else if (match[++m].rm_so >= 0)
-    state.scheduled_test_next_check = (time_t)val;
-  else if (match[++m].rm_so >= 0)
-    state.selective_test_last_start = val;
-  else if (match[++m].rm_so >= 0)
-    state.selective_test_last_end = val;
-  else if (match[++m].rm_so >= 0)
-    state.ataerrorcount = (int)val;
-  else if (match[m+=2].rm_so >= 0) {
-    int i = atoi(line+match[m].rm_so);
-    if (!(0 <= i && i < SMARTD_NMAIL))
-      return false;
-    if (i == MAILTYPE_TEST) // Don't suppress test mails
-      return true;
-    if (match[m+=2].rm_so >= 0)
-      state.maillog[i].logged = (int)val;
-    else if (match[++m].rm_so >= 0)
-      state.maillog[i].firstsent = (time_t)val;
-    else if (match[++m].rm_so >= 0)
-      state.maillog[i].lastsent = (time_t)val;
-    else
-      return false;
-  }
-  else if (match[m+=5+1].rm_so >= 0) {
-    int i = atoi(line+match[m].rm_so);
-    if (!(0 <= i && i < NUMBER_ATA_SMART_ATTRIBUTES))
-      return false;
-    if (match[m+=2].rm_so >= 0)
-      state.ata_attributes[i].id = (unsigned char)val;
-    else if (match[++m].rm_so >= 0)
-      state.ata_attributes[i].val = (unsigned char)val;
-    else if (match[++m].rm_so >= 0)
-      state.ata_attributes[i].worst = (unsigned char)val;
-    else if (match[++m].rm_so >= 0)
-      state.ata_attributes[i].raw = val;
-    else if (match[++m].rm_so >= 0)
-      state.ata_attributes[i].resvd = (unsigned char)val;
-    else
-      return false;
+  const state_file_key * key = nullptr;
+  for (const auto & sk : state_file_keys) {
+    if (!(sk.prefix ? prefix && str_equal(prefix, prefix_len, sk.prefix) : !prefix))
+      continue;
+    if (!str_equal(name, name_len, sk.name))
+      continue;
+    key = &sk.key;
+    break;
   }
-  else if (match[m+=7].rm_so >= 0)
-    state.nvme_err_log_entries = val;
-  else if (match[++m].rm_so >= 0)
-    state.nvme_smartval.avail_spare = val;
-  else if (match[++m].rm_so >= 0)
-    state.nvme_smartval.percent_used = val;
-  else if (match[++m].rm_so >= 0)
-    state.nvme_smartval.media_errors = uint64_to_uile128(val);
-  else
+  if (!key)
     return false;
+
+  switch (*key) {
+    case SK_TEMPMIN:
+      state.tempmin = (unsigned char)val; break;
+    case SK_TEMPMAX:
+      state.tempmax = (unsigned char)val; break;
+    case SK_SELFLOGCOUNT:
+      state.selflogcount = (unsigned char)val; break;
+    case SK_SELFLOGHOUR:
+      state.selfloghour = val; break;
+    case SK_TEST_NEXT_CHECK:
+      state.scheduled_test_next_check = (time_t)val; break;
+    case SK_SELECTIVE_START:
+      state.selective_test_last_start = val; break;
+    case SK_SELECTIVE_END:
+      state.selective_test_last_end = val; break;
+    case SK_ATAERRORCOUNT:
+      state.ataerrorcount = (int)val; break;
+
+    case SK_MAIL_COUNT:
+    case SK_MAIL_FIRSTSENT:
+    case SK_MAIL_LASTSENT:
+      if (!(index < SMARTD_NMAIL))
+        return false;
+      if (index == MAILTYPE_TEST) // Don't suppress test mails
+        break;
+      if (*key == SK_MAIL_COUNT)
+        state.maillog[index].logged = (int)val;
+      else if (*key == SK_MAIL_FIRSTSENT)
+        state.maillog[index].firstsent = (time_t)val;
+      else
+        state.maillog[index].lastsent = (time_t)val;
+      break;
+
+    case SK_ATTR_ID:
+    case SK_ATTR_VAL:
+    case SK_ATTR_WORST:
+    case SK_ATTR_RAW:
+    case SK_ATTR_RESVD:
+      {
+        if (!(index < NUMBER_ATA_SMART_ATTRIBUTES))
+          return false;
+        auto & pa = state.ata_attributes[index];
+        switch (*key) {
+          case SK_ATTR_ID:    pa.id = (unsigned char)val; break;
+          case SK_ATTR_VAL:   pa.val = (unsigned char)val; break;
+          case SK_ATTR_WORST: pa.worst = (unsigned char)val; break;
+          case SK_ATTR_RAW:   pa.raw = val; break;
+          default:            pa.resvd = (unsigned char)val; break;
+        }
+      }
+      break;
+
+    case SK_NVME_ERR_LOG_ENTRIES:
+      state.nvme_err_log_entries = val; break;
+    case SK_NVME_AVAIL_SPARE:
+      state.nvme_smartval.avail_spare = val; break;
+    case SK_NVME_PERCENT_USED:
+      state.nvme_smartval.percent_used = val; break;
+    case SK_NVME_MEDIA_ERRORS:
+      state.nvme_smartval.media_errors = uint64_to_uile128(val); break;
+  }
   return true;
 }
 
-// Read a state file.
-static bool read_dev_state(const char * path, persistent_dev_state & state)
+// Parse the lines of a state file.
+static bool parse_dev_state_text(const char * path, const char * text, persistent_dev_state & state)
 {
-  stdio_file f(path, "r");
-  if (!f) {
-    if (errno != ENOENT)
-      lib_printf("Cannot read state file \"%s\"\n", path);
-    return false;
-  }
-#ifdef __CYGWIN__
-  setmode(fileno(f), O_TEXT); // Allow files with \r\n
-#endif
-
   persistent_dev_state new_state;
   int good = 0, bad = 0;
-  char line[256];
-  while (fgets(line, sizeof(line), f)) {
-    const char * s = line + strspn(line, " \t");
+  for (const char * p = text; *p; ) {
+    size_t len = strcspn(p, "\n");
+    std::string line(p, len);
+    p += len + (p[len] ? 1 : 0);
+    const char * s = line.c_str() + strspn(line.c_str(), " \t");
     if (!*s || *s == '#')
       continue;
-    if (!parse_dev_state_line(line, new_state))
+    if (!parse_dev_state_line(line.c_str(), new_state))
       bad++;
     else
       good++;
@@ -776,33 +968,72 @@ static bool read_dev_state(const char * path, persistent_dev_state & state)
   return true;
 }
 
-static void write_dev_state_line(FILE * f, const char * name, uint64_t val)
+static state_journal dev_state_journal;
+
+// Return name of state file relative to path prefix, used as journal key.
+static std::string state_journal_key(const char * path)
 {
-  if (val)
-    fprintf(f, "%s = %" PRIu64 "\n", name, val);
+  if (!strncmp(path, state_path_prefix.c_str(), state_path_prefix.size()))
+    path += state_path_prefix.size();
+  return path;
 }
 
-static void write_dev_state_line(FILE * f, const char * name1, int id, const char * name2, uint64_t val)
+// Return location of state file for log messages.
+static std::string state_location(const std::string & path)
 {
-  if (val)
-    fprintf(f, "%s.%d.%s = %" PRIu64 "\n", name1, id, name2, val);
+  if (!state_journal_enabled)
+    return path;
+  return strprintf("%s [%s]", dev_state_journal.path(), state_journal_key(path.c_str()).c_str());
 }
 
-// Write a state file
-static bool write_dev_state(const char * path, const persistent_dev_state & state)
+// Read a state file.
+static bool read_dev_state(const char * path, persistent_dev_state & state)
 {
-  // Rename old "file" to "file~"
-  std::string pathbak = path; pathbak += '~';
-  unlink(pathbak.c_str());
-  rename(path, pathbak.c_str());
+  if (state_journal_enabled) {
+    const std::string * text = dev_state_journal.find(state_journal_key(path));
+    if (text)
+      return parse_dev_state_text(state_location(path).c_str(), text->c_str(), state);
+    // Not in journal, migrate existing state file
+  }
 
-  stdio_file f(path, "w");
+  stdio_file f(path, "r");
   if (!f) {
-    lib_printf("Cannot create state file \"%s\"\n", path);
+    if (errno != ENOENT)
+      lib_printf("Cannot read state file \"%s\"\n", path);
     return false;
   }
+#ifdef __CYGWIN__
+  setmode(fileno(f), O_TEXT); // Allow files with \r\n
+#endif
 
-  fprintf(f, "# smartd state file\n");
+  std::string text;
+  char line[256];
+  while (fgets(line, sizeof(line), f))
+    text += line;
+
+  if (!parse_dev_state_text(path, text.c_str(), state))
+    return false;
+  if (state_journal_enabled)
+    lib_printf("%s: state file will be migrated to journal %s\n", path, dev_state_journal.path());
+  return true;
+}
+
+static void write_dev_state_line(std::string & f, const char * name, uint64_t val)
+{
+  if (val)
+    f += strprintf("%s = %" PRIu64 "\n", name, val);
+}
+
+static void write_dev_state_line(std::string & f, const char * name1, int id, const char * name2, uint64_t val)
+{
+  if (val)
+    f += strprintf("%s.%d.%s = %" PRIu64 "\n", name1, id, name2, val);
+}
+
+// Format the lines of a state file
+static std::string format_dev_state(const persistent_dev_state & state)
+{
+  std::string f;
   write_dev_state_line(f, "temperature-min", state.tempmin);
   write_dev_state_line(f, "temperature-max", state.tempmax);
   write_dev_state_line(f, "self-test-errors", state.selflogcount);
@@ -843,9 +1074,255 @@ static bool write_dev_state(const char * path, const persistent_dev_state & stat
   write_dev_state_line(f, "nvme-media-errors",
     uile128_clamp_to_uint64(state.nvme_smartval.media_errors));
 
+  return f;
+}
+
+// Write a state file
+static bool write_dev_state(const char * path, const persistent_dev_state & state)
+{
+  // Rename old "file" to "file~"
+  std::string pathbak = path; pathbak += '~';
+  unlink(pathbak.c_str());
+  rename(path, pathbak.c_str());
+
+  stdio_file f(path, "w");
+  if (!f) {
+    lib_printf("Cannot create state file \"%s\"\n", path);
+    return false;
+  }
+
+  fprintf(f, "# smartd state file\n");
+  fputs(format_dev_state(state).c_str(), f);
+  return true;
+}
+
+// Print state read from state file PATH, used for '-E'.
+static int extract_dev_state(const char * path)
+{
+  state_journal_enabled = false;
+  persistent_dev_state state;
+  errno = 0;
+  if (!read_dev_state(path, state)) {
+    if (errno == ENOENT) // Not reported by read_dev_state()
+      PrintOut(LOG_CRIT, "%s: Cannot read state file: %s\n", path, strerror(errno));
+    return EXIT_BADCMD;
+  }
+  PrintOut(LOG_INFO, "%s", format_dev_state(state).c_str());
+  return 0;
+}
+
+// Atomic replace of file PATH by TMPPATH.  Removes TMPPATH on error.
+static bool replace_file(const char * tmppath, const char * path)
+{
+  // POSIX rename() replaces the destination atomically;
+  // on Windows the MSVCRT/MinGW rename() fails if the destination exists,
+  // so use MoveFileExA(MOVEFILE_REPLACE_EXISTING) which provides the same
+  // semantics on NTFS. Cygwin maps rename() to POSIX behavior already.
+#ifdef _WIN32
+  if (!MoveFileExA(tmppath, path, MOVEFILE_REPLACE_EXISTING)) {
+    lib_printf("Cannot rename \"%s\" to \"%s\", Error=%ld\n",
+               tmppath, path, GetLastError());
+    unlink(tmppath);
+    return false;
+  }
+#else
+  if (rename(tmppath, path)) {
+    lib_printf("Cannot rename \"%s\" to \"%s\": %s\n", tmppath, path, strerror(errno));
+    unlink(tmppath);
+    return false;
+  }
+#endif
   return true;
 }
 
+// Flush file buffers to disk.
+static bool sync_file(FILE * f)
+{
+  if (fflush(f))
+    return false;
+#ifdef _WIN32
+  return !_commit(_fileno(f));
+#else
+  return !fsync(fileno(f));
+#endif
+}
+
+#ifdef HAVE_POSIX_API
+// Flush directory entry of file PATH to disk, e.g. after rename().
+static bool sync_file_dir(const char * path)
+{
+  const char * slash = strrchr(path, '/');
+  std::string dir = (!slash ? "." : slash == path ? "/" : std::string(path, slash - path));
+  int fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd < 0)
+    return false;
+  bool ok = !fsync(fd);
+  ::close(fd);
+  return ok;
+}
+#endif // HAVE_POSIX_API
+
+// FNV-1a hash of journal batch.
+static uint32_t state_journal_hash(const char * data, size_t size)
+{
+  uint32_t hash = 0x811c9dc5;
+  for (size_t i = 0; i < size; i++)
+    hash = (hash ^ (unsigned char)data[i]) * 0x01000193;
+  return hash;
+}
+
+void state_journal::load()
+{
+  m_loaded = true;
+  m_path = state_path_prefix + "journal";
+  stdio_file f(m_path.c_str(), "rb");
+  if (!f) {
+    if (errno != ENOENT)
+      lib_printf("Cannot read state journal \"%s\"\n", m_path.c_str());
+    return;
+  }
+
+  std::string data;
+  char buf[8192];
+  for (size_t n; (n = fread(buf, 1, sizeof(buf), f)) > 0; )
+    data.append(buf, n);
+
+  // Parse "[NAME]" records, keep only batches with valid "[commit SIZE HASH]"
+  std::map<std::string, std::string> batch;
+  std::string * text = nullptr;
+  size_t batch_start = 0;
+  for (size_t pos = 0, end; pos < data.size(); pos = end + 1) {
+    end = data.find('\n', pos);
+    if (end == std::string::npos)
+      break; // Incomplete last line
+    const char * line = data.c_str() + pos;
+    int len = (int)(end - pos);
+    if (!(len >= 2 && line[0] == '[' && line[len-1] == ']')) {
+      if (text)
+        text->append(line, len + 1);
+      continue;
+    }
+
+    unsigned size = 0, hash = 0; int n = -1;
+    if (!(sscanf(line, "[commit %u %x]%n", &size, &hash, &n) == 2 && n == len)) {
+      text = &batch[std::string(line + 1, len - 2)];
+      text->clear();
+      continue;
+    }
+
+    if (!(   size == pos - batch_start
+          && hash == state_journal_hash(data.c_str() + batch_start, size)))
+      break; // Damaged batch
+    for (auto & rec : batch)
+      m_states[rec.first] = std::move(rec.second);
+    batch.clear(); text = nullptr;
+    batch_start = end + 1;
+  }
+
+  if (batch_start < data.size()) {
+    lib_printf("%s: %u bytes after last valid commit ignored\n", m_path.c_str(),
+               (unsigned)(data.size() - batch_start));
+    m_size = 0; // Rewrite on next commit
+  }
+  else
+    m_size = data.size();
+}
+
+const std::string * state_journal::find(const std::string & name)
+{
+  if (!m_loaded)
+    load();
+  auto it = m_states.find(name);
+  return (it != m_states.end() ? &it->second : nullptr);
+}
+
+void state_journal::add(const std::string & name, std::string && text)
+{
+  if (!m_loaded)
+    load();
+  m_states[name] = std::move(text);
+  m_pending.push_back(name);
+}
+
+bool state_journal::write(const char * path, const char * mode, const std::string & data)
+{
+  stdio_file f(path, mode);
+  if (!f) {
+    lib_printf("Cannot create state journal \"%s\"\n", path);
+    return false;
+  }
+  bool ok = (fwrite(data.data(), 1, data.size(), f) == data.size() && sync_file(f));
+  if (!f.close())
+    ok = false;
+  if (!ok)
+    lib_printf("Cannot write state journal \"%s\": %s\n", path, strerror(errno));
+  return ok;
+}
+
+bool state_journal::commit(const std::set<std::string> & registered)
+{
+  if (m_pending.empty())
+    return true;
+
+  // Rewrite if journal is new, damaged or too large
+  uint64_t live_size = 0;
+  for (const auto & st : m_states) {
+    if (registered.count(st.first))
+      live_size += st.first.size() + 3 + st.second.size();
+  }
+  bool compact = (!m_size || m_size > 2 * live_size + 0x10000);
+
+  // Drop states of devices which are no longer monitored
+  if (compact) {
+    for (auto it = m_states.begin(); it != m_states.end(); ) {
+      if (!registered.count(it->first))
+        it = m_states.erase(it);
+      else
+        ++it;
+    }
+  }
+
+  std::string batch;
+  auto add_record = [&batch](const std::string & name, const std::string & text) {
+    batch += '['; batch += name; batch += "]\n";
+    batch += text;
+  };
+  if (compact) {
+    batch = "# smartd state journal\n";
+    for (const auto & st : m_states)
+      add_record(st.first, st.second);
+  }
+  else {
+    for (const std::string & name : m_pending)
+      add_record(name, m_states[name]);
+  }
+  m_pending.clear();
+  batch += strprintf("[commit %u %08x]\n", (unsigned)batch.size(),
+                     state_journal_hash(batch.data(), batch.size()));
+
+  bool ok;
+  if (compact) {
+    std::string tmppath = m_path + ".tmp";
+    ok = (   write(tmppath.c_str(), "wb", batch)
+          && replace_file(tmppath.c_str(), m_path.c_str()));
+#ifdef HAVE_POSIX_API
+    if (ok && !sync_file_dir(m_path.c_str())) {
+      lib_printf("Cannot sync directory of state journal \"%s\": %s\n",
+                 m_path.c_str(), strerror(errno));
+      ok = false;
+    }
+#endif
+    m_size = batch.size();
+  }
+  else {
+    ok = write(m_path.c_str(), "ab", batch);
+    m_size += batch.size();
+  }
+  if (!ok)
+    m_size = 0; // Rewrite on next commit
+  return ok;
+}
+
 static void write_ata_attrlog(FILE * f, const dev_state & state)
 {
   for (const auto & pa : state.ata_attributes) {
@@ -923,36 +1400,39 @@ static void write_nvme_attrlog(FILE * f, const dev_state & state)
   );
 }
 
-// Write a JSON state file for one device, using the same json tree builder
+// JSON output appended to a string
+class string_json_output : public json::output_function
+{
+public:
+  explicit string_json_output(std::string & buf)
+    : m_buf(buf) { }
+  virtual void operator()(const char * str) override
+    { m_buf += str; }
+  virtual void write(const void * data, unsigned size) override
+    { m_buf.append((const char *)data, size); }
+private:
+  std::string & m_buf;
+};
+
+// Build the JSON state of one device, using the same json tree builder
 // and field names as smartctl -j so consumers can share a single parser.
-// Caller gates on state.json_dirty (set when this cycle produced fresh data);
 // cfg.json_dev_type (1=ATA, 2=SCSI, 3=NVMe) drives the per-protocol block.
-static bool write_dev_state_json(const char * path, const dev_config & cfg,
-                                 const dev_state & state)
+// JS is the json tree of a state file or a json::ref to a snapshot entry.
+template <class JSON>
+static void set_dev_state_json(JSON & js, const dev_config & cfg,
+                               const dev_state & state, time_t now)
 {
-  std::string tmppath = path; tmppath += '~';
-
-  stdio_file f(tmppath.c_str(), "w");
-  if (!f) {
-    lib_printf("Cannot create JSON state file \"%s\"\n", tmppath.c_str());
-    return false;
-  }
-
-  json js;
-  js.enable();
-
-  js["json_format_version"] += {1, 0};
-
   js["device"]["name"] = cfg.dev_name;
   js["device"]["info_name"] = cfg.name;
   js["device"]["protocol"] = cfg.json_protocol;
   if (!cfg.dev_idinfo.empty())
     js["device_info"] = cfg.dev_idinfo;
 
-  time_t now = time(nullptr);
-  char now_buf[DATEANDEPOCHLEN];
-  dateandtimezoneepoch(now_buf, now);
-  js["local_time"] += { {"time_t", now}, {"asctime", now_buf} };
+  if (now) {
+    char now_buf[DATEANDEPOCHLEN];
+    dateandtimezoneepoch(now_buf, now);
+    js["local_time"] += { {"time_t", now}, {"asctime", now_buf} };
+  }
 
   if (state.smart_health_status)
     js["smart_status"]["passed"] = (state.smart_health_status > 0);
@@ -1077,39 +1557,215 @@ static bool write_dev_state_json(const char * path, const dev_config & cfg,
       break;
     }
   }
+}
+
+// Batched writer for the JSON state files of one check cycle.  The json
+// tree and the output buffer are reused for all devices.  All temporary
+// files are written first, then renamed.  On POSIX systems, files are
+// accessed relative to a descriptor of the '-j' PREFIX directory and
+// the directory is synced once per cycle if ',sync' is specified.
+class json_state_writer
+{
+public:
+  json_state_writer()
+    { m_js.enable(); }
+
+  ~json_state_writer()
+    { close_dir(); }
+
+  // Start a new cycle for files in the directory of PATH_PREFIX.
+  void begin(const std::string & path_prefix, bool sync);
+
+  // Tree for the next file, cleared by write().
+  json & js()
+    { return m_js; }
+
+  // Write the tree to the temporary file for PATH.
+  bool write(const std::string & path, unsigned index);
+
+  // Rename all temporary files, append indexes of replaced files to DONE.
+  void commit(std::vector<unsigned> & done);
+
+private:
+  json m_js;
+  std::string m_buf;
+  bool m_sync = false;
+  std::string m_dir;
+  std::vector< std::pair<std::string, unsigned> > m_pending; // path, index
+#ifdef HAVE_POSIX_API
+  int m_dirfd = -1;
+
+  // Return name relative to m_dirfd.
+  const char * at_name(const std::string & path) const;
+#endif
+
+  void close_dir();
+};
+
+void json_state_writer::begin(const std::string & path_prefix, bool sync)
+{
+  m_sync = sync;
+  m_pending.clear();
+  close_dir();
+  size_t n = path_prefix.rfind('/');
+  m_dir = (n != std::string::npos ? path_prefix.substr(0, n + 1) : "");
+#ifdef HAVE_POSIX_API
+  // Fall back to plain paths (AT_FDCWD) on error
+  m_dirfd = open((!m_dir.empty() ? m_dir.c_str() : "."), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+#endif
+}
+
+void json_state_writer::close_dir()
+{
+#ifdef HAVE_POSIX_API
+  if (m_dirfd >= 0) {
+    ::close(m_dirfd);
+    m_dirfd = -1;
+  }
+#endif
+}
+
+#ifdef HAVE_POSIX_API
+const char * json_state_writer::at_name(const std::string & path) const
+{
+  if (m_dirfd >= 0 && !path.compare(0, m_dir.size(), m_dir)
+      && path.find('/', m_dir.size()) == std::string::npos)
+    return path.c_str() + m_dir.size();
+  return path.c_str();
+}
+#endif
 
+bool json_state_writer::write(const std::string & path, unsigned index)
+{
+  m_buf.clear();
   json::output_options opts;
   opts.pretty = true;
   opts.sorted = false;
-  js.output([&f](const char * str){ fputs(str, f); }, nullptr, opts);
+  opts.format = json_state_format;
+  string_json_output out(m_buf);
+  m_js.output(out, opts);
+  m_js.clear();
 
-  if (!f.close()) {
-    lib_printf("Cannot write JSON state file \"%s\": %s\n", tmppath.c_str(), strerror(errno));
-    unlink(tmppath.c_str());
+  std::string tmppath = path; tmppath += '~';
+#ifdef HAVE_POSIX_API
+  int dirfd = (m_dirfd >= 0 ? m_dirfd : AT_FDCWD);
+  const char * tmpname = at_name(tmppath);
+  int fd = openat(dirfd, tmpname, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+  if (fd < 0) {
+    lib_printf("Cannot create JSON state file \"%s\"\n", tmppath.c_str());
     return false;
   }
-  // Atomic replace. POSIX rename() replaces the destination atomically;
-  // on Windows the MSVCRT/MinGW rename() fails if the destination exists,
-  // so use MoveFileExA(MOVEFILE_REPLACE_EXISTING) which provides the same
-  // semantics on NTFS. Cygwin maps rename() to POSIX behavior already.
-#ifdef _WIN32
-  if (!MoveFileExA(tmppath.c_str(), path, MOVEFILE_REPLACE_EXISTING)) {
-    lib_printf("Cannot rename \"%s\" to \"%s\", Error=%ld\n",
-               tmppath.c_str(), path, GetLastError());
-    unlink(tmppath.c_str());
+  // Keep errno of the first failing call
+  int err = 0;
+  for (size_t pos = 0; !err && pos < m_buf.size(); ) {
+    ssize_t rc = ::write(fd, m_buf.data() + pos, m_buf.size() - pos);
+    if (rc > 0)
+      pos += rc;
+    else if (!(rc < 0 && errno == EINTR))
+      err = (rc < 0 ? errno : EIO);
+  }
+  if (!err && m_sync && fsync(fd))
+    err = errno;
+  if (::close(fd) && !err)
+    err = errno;
+  if (err) {
+    lib_printf("Cannot write JSON state file \"%s\": %s\n", tmppath.c_str(), strerror(err));
+    unlinkat(dirfd, tmpname, 0);
     return false;
   }
 #else
-  if (rename(tmppath.c_str(), path)) {
-    lib_printf("Cannot rename \"%s\" to \"%s\": %s\n", tmppath.c_str(), path, strerror(errno));
+  stdio_file f(tmppath.c_str(), (json_state_format == 'b' ? "wb" : "w"));
+  if (!f) {
+    lib_printf("Cannot create JSON state file \"%s\"\n", tmppath.c_str());
+    return false;
+  }
+  if (!(   fwrite(m_buf.data(), 1, m_buf.size(), f) == m_buf.size()
+        && (!m_sync || sync_file(f)) && f.close())) {
+    lib_printf("Cannot write JSON state file \"%s\": %s\n", tmppath.c_str(), strerror(errno));
+    f.close();
     unlink(tmppath.c_str());
     return false;
   }
 #endif
 
+  m_pending.emplace_back(path, index);
   return true;
 }
 
+void json_state_writer::commit(std::vector<unsigned> & done)
+{
+  for (const auto & pi : m_pending) {
+    std::string tmppath = pi.first; tmppath += '~';
+#ifdef HAVE_POSIX_API
+    int dirfd = (m_dirfd >= 0 ? m_dirfd : AT_FDCWD);
+    if (renameat(dirfd, at_name(tmppath), dirfd, at_name(pi.first))) {
+      lib_printf("Cannot rename \"%s\" to \"%s\": %s\n", tmppath.c_str(),
+                 pi.first.c_str(), strerror(errno));
+      unlinkat(dirfd, at_name(tmppath), 0);
+      continue;
+    }
+#else
+    if (!replace_file(tmppath.c_str(), pi.first.c_str()))
+      continue;
+#endif
+    done.push_back(pi.second);
+  }
+
+#ifdef HAVE_POSIX_API
+  // One directory sync makes all renames of this cycle durable
+  if (m_sync && !done.empty() && m_dirfd >= 0 && fsync(m_dirfd))
+    lib_printf("Cannot sync directory \"%s\": %s\n",
+               (!m_dir.empty() ? m_dir.c_str() : "."), strerror(errno));
+#endif
+  m_pending.clear();
+  close_dir();
+}
+
+// Keeps allocated json nodes and buffer for the next cycle
+static json_state_writer json_writer;
+
+// Write JSON snapshot file with all devices ('-O' option).
+static void write_dev_states_json_snapshot(const dev_config_vector & configs,
+                                           dev_state_vector & states)
+{
+  // Incremented for each snapshot, allows consumers to detect changes
+  static uint64_t sequence = 0;
+
+  json_state_writer & writer = json_writer;
+  writer.begin(json_snapshot_path, json_state_sync);
+  json & js = writer.js();
+
+  time_t now = time(nullptr);
+  char now_buf[DATEANDEPOCHLEN];
+  dateandtimezoneepoch(now_buf, now);
+  js["json_format_version"] += {1, 0};
+  js["smartd_snapshot"]["sequence"] = ++sequence;
+  js["local_time"] += { {"time_t", now}, {"asctime", now_buf} };
+
+  int ji = 0;
+  for (unsigned i = 0; i < states.size(); i++) {
+    const dev_config & cfg = configs.at(i);
+    dev_state & state = states[i];
+    if (state.removed)
+      continue;
+    // Devices without fresh data are included with the time of their last update
+    if (state.json_fresh)
+      state.json_update_time = now;
+    json::ref jref = js["devices"][ji++];
+    jref["fresh"] = state.json_fresh;
+    set_dev_state_json(jref, cfg, state, state.json_update_time);
+    // Independent of json_dirty which is kept until the per-device file is written
+    state.json_fresh = false;
+  }
+
+  std::vector<unsigned> done;
+  writer.write(json_snapshot_path, 0);
+  writer.commit(done);
+  if (!done.empty() && debugmode)
+    PrintOut(LOG_INFO, "JSON snapshot #%" PRIu64 " of %d devices written to %s\n",
+             sequence, ji, json_snapshot_path.c_str());
+}
+
 // Write JSON state files for devices that were successfully checked this cycle.
 // Gated on per-cycle state.json_dirty flag (set in *CheckDevice routines on
 // successful read) to avoid republishing stale data with a fresh local_time
@@ -1117,36 +1773,249 @@ static bool write_dev_state_json(const char * path, const dev_config & cfg,
 static void write_all_dev_states_json(const dev_config_vector & configs,
                                       dev_state_vector & states)
 {
+  json_state_writer & writer = json_writer;
+  writer.begin(json_state_path_prefix, json_state_sync);
+
+  time_t now = time(nullptr);
   for (unsigned i = 0; i < states.size(); i++) {
     const dev_config & cfg = configs.at(i);
     if (cfg.json_state_file.empty())
       continue;
-    dev_state & state = states[i];
+    const dev_state & state = states[i];
     if (state.removed || !state.json_dirty)
       continue;
-    if (!write_dev_state_json(cfg.json_state_file.c_str(), cfg, state))
-      continue;
-    state.json_dirty = false;
+    json & js = writer.js();
+    js["json_format_version"] += {1, 0};
+    set_dev_state_json(js, cfg, state, now);
+    writer.write(cfg.json_state_file, i);
+  }
+
+  std::vector<unsigned> done;
+  writer.commit(done);
+  for (unsigned i : done) {
+    states[i].json_dirty = false;
     if (debugmode)
       PrintOut(LOG_INFO, "Device: %s, JSON state written to %s\n",
-               cfg.name.c_str(), cfg.json_state_file.c_str());
+               configs.at(i).name.c_str(), configs.at(i).json_state_file.c_str());
+  }
+}
+
+// Binary attribute log file format.  All integers are little endian.
+// Header: "SMARTDAL", uint32 version, uint32 number of columns N,
+//         N column names, each NUL padded to attrlog_bin_namesize bytes.
+// Record: int64 time (seconds since the epoch), N int64 values.
+// All records have the same size, so record I starts at a known offset.
+// As records are appended in time order, a reader can binary search
+// the start time and then read only the requested column.
+const char attrlog_bin_magic[] = "SMARTDAL";
+const unsigned attrlog_bin_version = 1;
+const unsigned attrlog_bin_namesize = 48;
+const unsigned attrlog_bin_maxcols = 1024;
+// Value of columns not present in a record
+const int64_t attrlog_bin_novalue = INT64_MIN;
+
+// Named values of one attribute log record
+typedef std::vector< std::pair<std::string, int64_t> > attrlog_columns;
+
+static void get_ata_attrlog_columns(attrlog_columns & cols, const dev_state & state)
+{
+  for (const auto & pa : state.ata_attributes) {
+    if (!pa.id)
+      continue;
+    cols.emplace_back(strprintf("%d-val", pa.id), pa.val);
+    cols.emplace_back(strprintf("%d-raw", pa.id), (int64_t)pa.raw);
+  }
+}
+
+static void get_scsi_attrlog_columns(attrlog_columns & cols, const dev_state & state)
+{
+  static const char * const counterNames[7] = {
+    "corr-by-ecc-fast", "corr-by-ecc-delayed", "corr-by-retry",
+    "total-err-corrected", "corr-algorithm-invocations",
+    "bytes-processed", "total-unc-errors"
+  };
+  const char * pageNames[3] = {"read", "write", "verify"};
+  for (int k = 0; k < 3; ++k) {
+    if (!state.scsi_error_counters[k].found)
+      continue;
+    const scsiErrorCounter & ec = state.scsi_error_counters[k].errCounter;
+    for (int i = 0; i < 7; i++)
+      cols.emplace_back(strprintf("%s-%s", pageNames[k], counterNames[i]),
+                        (int64_t)ec.counter[i]);
+  }
+  if (state.scsi_nonmedium_error.found && state.scsi_nonmedium_error.nme.gotPC0)
+    cols.emplace_back("non-medium-errors", (int64_t)state.scsi_nonmedium_error.nme.counterPC0);
+  if (state.temperature)
+    cols.emplace_back("temperature", state.temperature);
+}
+
+static void get_nvme_attrlog_columns(attrlog_columns & cols, const dev_state & state)
+{
+  const nvme_smart_log & s = state.nvme_smartval;
+  // Same names as in CSV format
+  cols.emplace_back("critical-warning", s.critical_warning);
+  cols.emplace_back("temperature", (int)uile16_to_uint(s.temperature) - 273);
+  cols.emplace_back("available-spare", s.avail_spare);
+  cols.emplace_back("available-spare-threshold", s.spare_thresh);
+  cols.emplace_back("percentage-used", s.percent_used);
+  cols.emplace_back("data-units-read", (int64_t)uile128_clamp_to_uint64(s.data_units_read));
+  cols.emplace_back("data-units-written", (int64_t)uile128_clamp_to_uint64(s.data_units_written));
+  cols.emplace_back("host-reads", (int64_t)uile128_clamp_to_uint64(s.host_reads));
+  cols.emplace_back("host-writes", (int64_t)uile128_clamp_to_uint64(s.host_writes));
+  cols.emplace_back("controller-busy-time", (int64_t)uile128_clamp_to_uint64(s.ctrl_busy_time));
+  cols.emplace_back("power-cycles", (int64_t)uile128_clamp_to_uint64(s.power_cycles));
+  cols.emplace_back("power-on-hours", (int64_t)uile128_clamp_to_uint64(s.power_on_hours));
+  cols.emplace_back("unsafe-shutdowns", (int64_t)uile128_clamp_to_uint64(s.unsafe_shutdowns));
+  cols.emplace_back("media-errors", (int64_t)uile128_clamp_to_uint64(s.media_errors));
+  cols.emplace_back("num-err-log-entries", (int64_t)uile128_clamp_to_uint64(s.num_err_log_entries));
+}
+
+// Read header of binary attrlog file, return its size or 0 on error.
+static long read_attrlog_bin_header(FILE * f, std::vector<std::string> & names)
+{
+  names.clear();
+  unsigned char buf[16];
+  if (!(   fread(buf, 1, sizeof(buf), f) == sizeof(buf)
+        && !memcmp(buf, attrlog_bin_magic, 8)
+        && sg_get_unaligned_le32(buf + 8) == attrlog_bin_version))
+    return 0;
+  unsigned ncols = sg_get_unaligned_le32(buf + 12);
+  if (!(0 < ncols && ncols <= attrlog_bin_maxcols))
+    return 0;
+
+  for (unsigned i = 0; i < ncols; i++) {
+    char name[attrlog_bin_namesize];
+    if (fread(name, 1, sizeof(name), f) != sizeof(name) || name[sizeof(name)-1])
+      return 0;
+    names.push_back(name);
+  }
+  return sizeof(buf) + ncols * attrlog_bin_namesize;
+}
+
+// Write header of binary attrlog file, return its size or 0 on error.
+static long write_attrlog_bin_header(FILE * f, const std::vector<std::string> & names)
+{
+  std::string hdr(attrlog_bin_magic, 8);
+  unsigned char buf[8];
+  sg_put_unaligned_le32(attrlog_bin_version, buf);
+  sg_put_unaligned_le32(names.size(), buf + 4);
+  hdr.append((const char *)buf, sizeof(buf));
+  for (const auto & name : names) {
+    std::string padded = name.substr(0, attrlog_bin_namesize - 1);
+    padded.resize(attrlog_bin_namesize, 0);
+    hdr += padded;
+  }
+  if (fwrite(hdr.data(), 1, hdr.size(), f) != hdr.size())
+    return 0;
+  return hdr.size();
+}
+
+// Append a record to the binary attrlog file.  A new file is started
+// if the record contains a column which is not in the current file.
+static bool write_dev_attrlog_bin(const char * path, time_t now,
+                                  const attrlog_columns & cols)
+{
+  if (cols.empty() || cols.size() > attrlog_bin_maxcols)
+    return false;
+
+  std::vector<std::string> names;
+  std::vector<unsigned> idx(cols.size());
+  long hdrsize = 0;
+  stdio_file f(path, "r+b");
+  if (f) {
+    hdrsize = read_attrlog_bin_header(f, names);
+    for (unsigned i = 0; hdrsize && i < cols.size(); i++) {
+      idx[i] = std::find(names.begin(), names.end(), cols[i].first) - names.begin();
+      if (idx[i] >= names.size())
+        hdrsize = 0;
+    }
+    if (!hdrsize) {
+      // Keep old file
+      f.close();
+      struct tm tmbuf, * tms = time_to_tm_local(&tmbuf, now);
+      std::string oldpath = strprintf("%s.%d%02d%02d-%02d%02d%02d", path,
+        1900+tms->tm_year, 1+tms->tm_mon, tms->tm_mday,
+        tms->tm_hour, tms->tm_min, tms->tm_sec);
+      if (rename(path, oldpath.c_str())) {
+        lib_printf("Cannot rename attribute log file \"%s\": %s\n", path, strerror(errno));
+        return false;
+      }
+      PrintOut(LOG_INFO, "Attribute log columns changed, old file renamed to \"%s\"\n",
+               oldpath.c_str());
+    }
   }
+
+  if (!hdrsize) {
+    if (!f.open(path, "w+b")) {
+      lib_printf("Cannot create attribute log file \"%s\"\n", path);
+      return false;
+    }
+    names.clear();
+    for (unsigned i = 0; i < cols.size(); i++) {
+      names.push_back(cols[i].first);
+      idx[i] = i;
+    }
+    hdrsize = write_attrlog_bin_header(f, names);
+    if (!hdrsize)
+      return false;
+  }
+
+  // Append after the last complete record, overwrite a partial one
+  long recsize = 8 * (1 + names.size());
+  if (fseek(f, 0, SEEK_END))
+    return false;
+  long size = ftell(f);
+  if (size < hdrsize)
+    return false;
+  if ((size - hdrsize) % recsize) {
+    if (fseek(f, size - (size - hdrsize) % recsize, SEEK_SET))
+      return false;
+  }
+
+  std::vector<unsigned char> rec(recsize);
+  sg_put_unaligned_le64((uint64_t)now, rec.data());
+  for (unsigned i = 0; i < names.size(); i++)
+    sg_put_unaligned_le64((uint64_t)attrlog_bin_novalue, rec.data() + 8 * (1 + i));
+  for (unsigned i = 0; i < cols.size(); i++)
+    sg_put_unaligned_le64((uint64_t)cols[i].second, rec.data() + 8 * (1 + idx[i]));
+
+  if (fwrite(rec.data(), 1, rec.size(), f) != rec.size() || !f.close()) {
+    lib_printf("Cannot write attribute log file \"%s\"\n", path);
+    return false;
+  }
+  return true;
+}
+
+// Format time as "yyyy-mm-dd HH:MM:SS" in local time
+static std::string format_attrlog_time(time_t t)
+{
+  struct tm tmbuf, * tms = time_to_tm_local(&tmbuf, t);
+  return strprintf("%d-%02d-%02d %02d:%02d:%02d",
+                   1900+tms->tm_year, 1+tms->tm_mon, tms->tm_mday,
+                   tms->tm_hour, tms->tm_min, tms->tm_sec);
 }
 
 // Write to the attrlog file
 static bool write_dev_attrlog(const char * path, const dev_state & state)
 {
+  time_t now = time(nullptr);
+  if (attrlog_format == 'b') {
+    attrlog_columns cols;
+    switch (state.attrlog_valid) {
+      case 1: get_ata_attrlog_columns(cols, state); break;
+      case 2: get_scsi_attrlog_columns(cols, state); break;
+      case 3: get_nvme_attrlog_columns(cols, state); break;
+    }
+    return write_dev_attrlog_bin(path, now, cols);
+  }
+
   stdio_file f(path, "a");
   if (!f) {
     lib_printf("Cannot create attribute log file \"%s\"\n", path);
     return false;
   }
 
-  time_t now = time(nullptr);
-  struct tm tmbuf, * tms = time_to_tm_local(&tmbuf, now);
-  fprintf(f, "%d-%02d-%02d %02d:%02d:%02d;",
-             1900+tms->tm_year, 1+tms->tm_mon, tms->tm_mday,
-             tms->tm_hour, tms->tm_min, tms->tm_sec);
+  fprintf(f, "%s;", format_attrlog_time(now).c_str());
 
   switch (state.attrlog_valid) {
     case 1: write_ata_attrlog(f, state); break;
@@ -1158,26 +2027,166 @@ static bool write_dev_attrlog(const char * path, const dev_state & state)
   return true;
 }
 
+// Read int64 at offset of binary attrlog file
+static bool read_attrlog_bin_value(FILE * f, long offset, int64_t & value)
+{
+  unsigned char buf[8];
+  if (fseek(f, offset, SEEK_SET) || fread(buf, 1, sizeof(buf), f) != sizeof(buf))
+    return false;
+  value = (int64_t)sg_get_unaligned_le64(buf);
+  return true;
+}
+
+// Print columns or time series and range of one column of a binary
+// attrlog file ('-X' option).  Returns exit status.
+static int extract_attrlog(const char * path, const char * name,
+                           time_t from, time_t to)
+{
+  stdio_file f(path, "rb");
+  if (!f) {
+    PrintOut(LOG_CRIT, "%s: Cannot open attribute log file: %s\n", path, strerror(errno));
+    return EXIT_BADCMD;
+  }
+  std::vector<std::string> names;
+  long hdrsize = read_attrlog_bin_header(f, names);
+  if (!hdrsize || fseek(f, 0, SEEK_END)) {
+    PrintOut(LOG_CRIT, "%s: Not a binary attribute log file\n", path);
+    return EXIT_BADCMD;
+  }
+  long recsize = 8 * (1 + names.size());
+  long numrecs = (ftell(f) - hdrsize) / recsize;
+
+  // Time of record I or limit if unreadable
+  auto rec_time = [&](long i, int64_t limit) -> int64_t {
+    int64_t t;
+    return (read_attrlog_bin_value(f, hdrsize + i * recsize, t) ? t : limit);
+  };
+
+  if (!*name) {
+    PrintOut(LOG_INFO, "%s: %ld records", path, numrecs);
+    if (numrecs > 0)
+      PrintOut(LOG_INFO, " from %s to %s",
+               format_attrlog_time(rec_time(0, 0)).c_str(),
+               format_attrlog_time(rec_time(numrecs - 1, 0)).c_str());
+    PrintOut(LOG_INFO, ", %u columns:\n", (unsigned)names.size());
+    for (const auto & n : names)
+      PrintOut(LOG_INFO, "  %s\n", n.c_str());
+    return 0;
+  }
+
+  unsigned col = std::find(names.begin(), names.end(), name) - names.begin();
+  if (col >= names.size()) {
+    PrintOut(LOG_CRIT, "%s: Column \"%s\" not found\n", path, name);
+    return EXIT_BADCMD;
+  }
+
+  // Find first record at or after start time
+  long lo = 0, hi = numrecs;
+  while (lo < hi) {
+    long mid = lo + (hi - lo) / 2;
+    if (rec_time(mid, INT64_MAX) < (int64_t)from)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  long count = 0;
+  int64_t minval = 0, maxval = 0;
+  time_t mintime = 0, maxtime = 0;
+  for (long i = lo; i < numrecs; i++) {
+    int64_t t, value;
+    if (!(   read_attrlog_bin_value(f, hdrsize + i * recsize, t)
+          && read_attrlog_bin_value(f, hdrsize + i * recsize + 8 * (1 + col), value))) {
+      PrintOut(LOG_CRIT, "%s: Read error\n", path);
+      return EXIT_BADCMD;
+    }
+    if (to && t > (int64_t)to)
+      break;
+    if (value == attrlog_bin_novalue)
+      continue;
+    PrintOut(LOG_INFO, "%s;%" PRId64 "\n", format_attrlog_time((time_t)t).c_str(), value);
+    if (!count || value < minval) {
+      minval = value; mintime = (time_t)t;
+    }
+    if (!count || value > maxval) {
+      maxval = value; maxtime = (time_t)t;
+    }
+    count++;
+  }
+
+  if (!count) {
+    PrintOut(LOG_INFO, "%s: no values\n", name);
+    return 0;
+  }
+  PrintOut(LOG_INFO, "%s: %ld values, min %" PRId64 " at %s, max %" PRId64 " at %s\n",
+           name, count, minval, format_attrlog_time(mintime).c_str(),
+           maxval, format_attrlog_time(maxtime).c_str());
+  return 0;
+}
+
+// Parse "yyyy-mm-dd[THH:MM[:SS]]" as local time, return 0 on error.
+static time_t parse_attrlog_time(const char * s)
+{
+  struct tm tm = {};
+  int n1 = -1, n2 = -1, n3 = -1, len = strlen(s);
+  if (sscanf(s, "%d-%d-%d%n", &tm.tm_year, &tm.tm_mon, &tm.tm_mday, &n1) != 3)
+    return 0;
+  if (n1 < len && !(   (s[n1] == 'T' || s[n1] == ' ')
+                    && sscanf(s + n1 + 1, "%d:%d%n:%d%n", &tm.tm_hour, &tm.tm_min, &n2,
+                              &tm.tm_sec, &n3) >= 2
+                    && (n1 + 1 + n2 == len || n1 + 1 + n3 == len)))
+    return 0;
+  if (!(   1970 <= tm.tm_year && 1 <= tm.tm_mon && tm.tm_mon <= 12
+        && 1 <= tm.tm_mday && tm.tm_mday <= 31 && 0 <= tm.tm_hour && tm.tm_hour <= 23
+        && 0 <= tm.tm_min && tm.tm_min <= 59 && 0 <= tm.tm_sec && tm.tm_sec <= 60))
+    return 0;
+  tm.tm_year -= 1900; tm.tm_mon--;
+  tm.tm_isdst = -1;
+  time_t t = mktime(&tm);
+  return (t != (time_t)-1 ? t : 0);
+}
+
+// Write state file or journal entry of one device
+static void write_one_dev_state(const dev_config & cfg, dev_state & state,
+                                bool write_always)
+{
+  if (cfg.state_file.empty())
+    return;
+  if (!write_always && !state.must_write)
+    return;
+  if (state_journal_enabled)
+    dev_state_journal.add(state_journal_key(cfg.state_file.c_str()), format_dev_state(state));
+  else if (!write_dev_state(cfg.state_file.c_str(), state))
+    return;
+  state.must_write = false;
+  if (write_always || debugmode)
+    PrintOut(LOG_INFO, "Device: %s, state written to %s\n",
+             cfg.name.c_str(), state_location(cfg.state_file).c_str());
+}
+
+// Commit the journal, keep states of registered devices.
+// A failed commit is retried with the next one.
+static void commit_dev_state_journal(const dev_config_vector & configs)
+{
+  std::set<std::string> registered;
+  for (const auto & cfg : configs) {
+    if (!cfg.state_file.empty())
+      registered.insert(state_journal_key(cfg.state_file.c_str()));
+  }
+  dev_state_journal.commit(registered);
+}
+
 // Write all state files. If write_always is false, don't write
 // unless must_write is set.
 static void write_all_dev_states(const dev_config_vector & configs,
                                  dev_state_vector & states,
                                  bool write_always = true)
 {
-  for (unsigned i = 0; i < states.size(); i++) {
-    const dev_config & cfg = configs.at(i);
-    if (cfg.state_file.empty())
-      continue;
-    dev_state & state = states[i];
-    if (!write_always && !state.must_write)
-      continue;
-    if (!write_dev_state(cfg.state_file.c_str(), state))
-      continue;
-    state.must_write = false;
-    if (write_always || debugmode)
-      PrintOut(LOG_INFO, "Device: %s, state written to %s\n",
-               cfg.name.c_str(), cfg.state_file.c_str());
-  }
+  for (unsigned i = 0; i < states.size(); i++)
+    write_one_dev_state(configs.at(i), states[i], write_always);
+
+  if (state_journal_enabled)
+    commit_dev_state_journal(configs);
 }
 
 // Write to all attrlog files
@@ -1319,129 +2328,76 @@ void env_buffer::set(const char * name, const char * value)
 
 #define EBUFLEN 1024
 
-static void MailWarning(const dev_config & cfg, dev_state & state, int which, const char *fmt, ...)
-  SMARTMON_FORMAT_PRINTF(4, 5);
+// Environment variables exported to the warning script
+static const char * const warning_env_names[] = {
+  "SMARTD_MAILER",
+  "SMARTD_MESSAGE",
+  "SMARTD_PREVCNT",
+  "SMARTD_TFIRST",
+  "SMARTD_TFIRSTEPOCH",
+  "SMARTD_FAILTYPE",
+  "SMARTD_ADDRESS",
+  "SMARTD_DEVICESTRING",
+  "SMARTD_DEVICETYPE",
+  "SMARTD_DEVICE",
+  "SMARTD_DEVICEINFO",
+  "SMARTD_NEXTDAYS",
+  "SMARTD_SUBJECT"
+};
 
-// If either address or executable path is non-null then send and log
-// a warning email, or execute executable
-static void MailWarning(const dev_config & cfg, dev_state & state, int which, const char *fmt, ...)
+const unsigned num_warning_env = sizeof(warning_env_names) / sizeof(warning_env_names[0]);
+
+// One run of the warning script
+struct warning_run
 {
-  // See if user wants us to send mail
-  if (cfg.emailaddress.empty() && cfg.emailcmdline.empty())
-    return;
+  std::string env[num_warning_env];       // Values of warning_env_names[]
+  std::string devname;                    // Device name, for coalescing
+  int which = 0;                          // Type of mail, 0 = EmailTest, -1 = Digest
+  time_t queued = 0;                      // Time of MailWarning() call
+  std::string digest_text;                // Details of all warnings of a digest
+};
 
-  // Which type of mail are we sending?
-  static const char * const whichfail[] = {
-    "EmailTest",                  // 0
-    "Health",                     // 1
-    "Usage",                      // 2
-    "SelfTest",                   // 3
-    "ErrorCount",                 // 4
-    "FailedHealthCheck",          // 5
-    "FailedReadSmartData",        // 6
-    "FailedReadSmartErrorLog",    // 7
-    "FailedReadSmartSelfTestLog", // 8
-    "FailedOpenDevice",           // 9
-    "CurrentPendingSector",       // 10
-    "OfflineUncorrectableSector", // 11
-    "Temperature"                 // 12
-  };
-  SMARTMON_STATIC_ASSERT(sizeof(whichfail) == SMARTD_NMAIL * sizeof(whichfail[0]));
-  
-  if (!(0 <= which && which < SMARTD_NMAIL)) {
-    PrintOut(LOG_CRIT, "Internal error in MailWarning(): which=%d\n", which);
-    return;
+// Run the warning script and log its result
+static void run_warning_script(const warning_run & run)
+{
+  static env_buffer env[num_warning_env];
+  for (unsigned i = 0; i < num_warning_env; i++)
+    env[i].set(warning_env_names[i], run.env[i].c_str());
+
+#ifdef HAVE_POSIX_API
+  // Write details of a digest to a temporary file
+  std::string digest_file;
+  if (!run.digest_text.empty()) {
+    char path[] = "/tmp/smartd-digest.XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0)
+      PrintOut(LOG_CRIT, "Warning digest: cannot create temporary file: %s\n", strerror(errno));
+    else {
+      // Script may run as non-privileged user
+      bool ok = !(warn_as_user && fchown(fd, warn_uid, warn_gid));
+      if (ok)
+        ok = (write(fd, run.digest_text.data(), run.digest_text.size())
+              == (ssize_t)run.digest_text.size());
+      if (!ok) {
+        PrintOut(LOG_CRIT, "Warning digest: cannot write temporary file %s: %s\n", path, strerror(errno));
+        unlink(path);
+      }
+      else
+        digest_file = path;
+      close(fd);
+    }
   }
-  mailinfo * mail = state.maillog + which;
-
-  // Calc current and next interval for warning reminder emails
-  int days, nextdays;
-  if (which == 0)
-    days = nextdays = -1; // EmailTest
-  else switch (cfg.emailfreq) {
-    case emailfreqs::once:
-      days = nextdays = -1; break;
-    case emailfreqs::always:
-      days = nextdays = 0; break;
-    case emailfreqs::daily:
-      days = nextdays = 1; break;
-    case emailfreqs::diminishing:
-      // 0, 1, 2, 3, 4, 5, 6, 7, ... => 1, 2, 4, 8, 16, 32, 32, 32, ...
-      nextdays = 1 << ((unsigned)mail->logged <= 5 ? mail->logged : 5);
-      // 0, 1, 2, 3, 4, 5, 6, 7, ... => 0, 1, 2, 4,  8, 16, 32, 32, ... (0 not used below)
-      days = ((unsigned)mail->logged <= 5 ? nextdays >> 1 : nextdays);
-      break;
-    default:
-      PrintOut(LOG_CRIT, "Internal error in MailWarning(): cfg.emailfreq=%d\n", (int)cfg.emailfreq);
-      return;
-  }
-
-  time_t now = time(nullptr);
-  if (mail->logged) {
-    // Return if no warning reminder email needs to be sent (now)
-    if (days < 0)
-      return; // '-M once' or EmailTest
-    if (days > 0 && now < mail->lastsent + days * 24 * 3600)
-      return; // '-M daily/diminishing' and too early
-  }
-  else {
-    // Record the time of this first email message
-    mail->firstsent = now;
-  }
-
-  // Record the time of this email message
-  mail->lastsent = now;
-
-  // print warning string into message
-  // Note: Message length may reach ~300 characters as device names may be
-  // very long on certain platforms (macOS ~230 characters).
-  // Message length must not exceed email line length limit, see RFC 5322:
-  // "... MUST be no more than 998 characters, ... excluding the CRLF."
-  char message[512];
-  va_list ap;
-  va_start(ap, fmt);
-  vsnprintf(message, sizeof(message), fmt, ap);
-  va_end(ap);
-
-  // replace commas by spaces to separate recipients
-  std::string address = cfg.emailaddress;
-  std::replace(address.begin(), address.end(), ',', ' ');
-
-  // Export information in environment variables that will be useful
-  // for user scripts
-  const char * executable = cfg.emailcmdline.c_str();
-  static env_buffer env[13];
-  env[0].set("SMARTD_MAILER", executable);
-  env[1].set("SMARTD_MESSAGE", message);
-  char dates[DATEANDEPOCHLEN];
-  snprintf(dates, sizeof(dates), "%d", mail->logged);
-  env[2].set("SMARTD_PREVCNT", dates);
-  dateandtimezoneepoch(dates, mail->firstsent);
-  env[3].set("SMARTD_TFIRST", dates);
-  snprintf(dates, DATEANDEPOCHLEN,"%d", (int)mail->firstsent);
-  env[4].set("SMARTD_TFIRSTEPOCH", dates);
-  env[5].set("SMARTD_FAILTYPE", whichfail[which]);
-  env[6].set("SMARTD_ADDRESS", address.c_str());
-  env[7].set("SMARTD_DEVICESTRING", cfg.name.c_str());
-
-  // Allow 'smartctl ... -d $SMARTD_DEVICETYPE $SMARTD_DEVICE'
-  env[8].set("SMARTD_DEVICETYPE",
-             (!cfg.dev_type.empty() ? cfg.dev_type.c_str() : "auto"));
-  env[9].set("SMARTD_DEVICE", cfg.dev_name.c_str());
-
-  env[10].set("SMARTD_DEVICEINFO", cfg.dev_idinfo.c_str());
-  dates[0] = 0;
-  if (nextdays >= 0)
-    snprintf(dates, sizeof(dates), "%d", nextdays);
-  env[11].set("SMARTD_NEXTDAYS", dates);
-  // Avoid false positive recursion detection by smartd_warning.{sh,cmd}
-  env[12].set("SMARTD_SUBJECT", "");
+  static env_buffer env_digest;
+  env_digest.set("SMARTD_DIGESTFILE", digest_file.c_str());
+#endif
 
   // now construct a command to send this as EMAIL
+  const char * executable = run.env[0].c_str();
   if (!*executable)
     executable = "<mail>";
+  const std::string & address = run.env[6];
   const char * newadd = (!address.empty()? address.c_str() : "<nomailer>");
-  const char * newwarn = (which? "Warning via" : "Test of");
+  const char * newwarn = (run.which? "Warning via" : "Test of");
 
   char command[256];
 #ifdef _WIN32
@@ -1453,7 +2409,7 @@ static void MailWarning(const dev_config & cfg, dev_state & state, int which, co
 
   // tell SYSLOG what we are about to do...
   PrintOut(LOG_INFO,"%s %s to %s%s ...\n",
-           (which ? "Sending warning via" : "Executing test of"), executable, newadd,
+           (run.which ? "Sending warning via" : "Executing test of"), executable, newadd,
            (
 #ifdef HAVE_POSIX_API
             warn_as_user ?
@@ -1560,6 +2516,440 @@ static void MailWarning(const dev_config & cfg, dev_state & state, int which, co
     }
   }
 
+#ifdef HAVE_POSIX_API
+  if (!digest_file.empty())
+    unlink(digest_file.c_str());
+#endif
+}
+
+#ifdef HAVE_POSIX_API
+
+// Runs warning scripts asynchronously in child processes, so a slow or
+// hanging mailer does not delay the checks of other devices.
+class warning_dispatcher
+{
+public:
+  // Queue run of warning script.  A queued run for the same device
+  // and mail type is replaced.
+  void enqueue(warning_run && run);
+
+  // Reap finished child processes, kill timed out ones and start
+  // queued runs.  Returns false if nothing is queued or running.
+  bool poll();
+
+  // Wait until all queued runs are finished.
+  void drain();
+
+private:
+  struct child_info
+  {
+    pid_t pid;
+    std::string devname;
+    time_t queued, started;
+    bool killed;
+  };
+
+  std::vector<warning_run> m_queue;
+  std::vector<child_info> m_children;
+
+  void start(const warning_run & run);
+};
+
+static warning_dispatcher warning_scripts;
+
+void warning_dispatcher::enqueue(warning_run && run)
+{
+  for (warning_run & qrun : m_queue) {
+    if (!(run.which >= 0 && qrun.devname == run.devname && qrun.which == run.which))
+      continue;
+    PrintOut(LOG_INFO, "Device: %s, warning coalesced with queued warning of same type (%u queued)\n",
+             run.devname.c_str(), (unsigned)m_queue.size());
+    time_t queued = qrun.queued;
+    qrun = std::move(run);
+    qrun.queued = queued;
+    return;
+  }
+
+  const unsigned max_queue = 64;
+  if (m_queue.size() >= max_queue) {
+    PrintOut(LOG_CRIT, "Device: %s, warning dropped, queue full (%u queued, %u running)\n",
+             run.devname.c_str(), (unsigned)m_queue.size(), (unsigned)m_children.size());
+    return;
+  }
+
+  m_queue.push_back(std::move(run));
+  poll();
+  if (!m_queue.empty())
+    PrintOut(LOG_INFO, "Device: %s, warning queued (%u queued, %u running)\n",
+             m_queue.back().devname.c_str(), (unsigned)m_queue.size(), (unsigned)m_children.size());
+}
+
+void warning_dispatcher::start(const warning_run & run)
+{
+  // Avoid duplicate output of buffered data from child
+  fflush(stdout);
+
+  pid_t pid = fork();
+  if (pid == (pid_t)-1) {
+    PrintOut(LOG_CRIT, "Device: %s, fork() for warning script failed (%s), running now\n",
+             run.devname.c_str(), strerror(errno));
+    run_warning_script(run);
+    return;
+  }
+
+  if (!pid) {
+    // Child: Use separate process group to allow kill() of script
+    // and mailer on timeout
+    setpgid(0, 0);
+    run_warning_script(run);
+    fflush(stdout);
+    _exit(0);
+  }
+
+  // Also set in parent to avoid race with kill()
+  setpgid(pid, pid);
+  child_info ci;
+  ci.pid = pid; ci.devname = run.devname;
+  ci.queued = run.queued; ci.started = time(nullptr);
+  ci.killed = false;
+  m_children.push_back(ci);
+}
+
+bool warning_dispatcher::poll()
+{
+  time_t now = time(nullptr);
+  for (unsigned i = 0; i < m_children.size(); ) {
+    child_info & ci = m_children[i];
+    int status = 0;
+    pid_t pid = waitpid(ci.pid, &status, WNOHANG);
+    if (!pid) {
+      // Still running
+      if (!ci.killed && now - ci.started >= warn_async_timeout) {
+        PrintOut(LOG_CRIT, "Device: %s, warning script timed out after %d seconds, killed\n",
+                 ci.devname.c_str(), (int)(now - ci.started));
+        kill(-ci.pid, SIGKILL);
+        ci.killed = true;
+      }
+      i++;
+      continue;
+    }
+
+    if (!ci.killed)
+      PrintOut(LOG_INFO, "Device: %s, warning script finished (dispatch latency %d, run time %d seconds, "
+               "%u queued)\n", ci.devname.c_str(), (int)(ci.started - ci.queued),
+               (int)(now - ci.started), (unsigned)m_queue.size());
+    m_children.erase(m_children.begin() + i);
+  }
+
+  while (!m_queue.empty() && m_children.size() < (unsigned)warn_async_max) {
+    warning_run run = std::move(m_queue.front());
+    m_queue.erase(m_queue.begin());
+    start(run);
+  }
+
+  return !(m_queue.empty() && m_children.empty());
+}
+
+void warning_dispatcher::drain()
+{
+  while (poll())
+    sleep(1);
+}
+
+// Run warning script now or pass it to the background dispatcher
+static void dispatch_warning_run(warning_run && run)
+{
+  if (warn_async_max > 0)
+    warning_scripts.enqueue(std::move(run));
+  else
+    run_warning_script(run);
+}
+
+// Groups warnings raised within 'warn_digest_window' seconds into one
+// run of the warning script per mailer and address.
+class warning_digest
+{
+public:
+  // Add warning to the digest of its mailer and address.
+  void add(warning_run && run);
+
+  // Dispatch digests whose window has expired, or all digests if
+  // 'flush' is set.  Returns false if no digest is pending.
+  bool poll(bool flush = false);
+
+private:
+  struct group
+  {
+    time_t deadline;
+    std::vector<warning_run> runs;
+  };
+
+  std::vector<group> m_groups;
+
+  static void dispatch(std::vector<warning_run> & runs);
+};
+
+static warning_digest warning_digests;
+
+void warning_digest::add(warning_run && run)
+{
+  for (group & g : m_groups) {
+    const warning_run & grun = g.runs.front();
+    if (!(grun.env[0] == run.env[0] && grun.env[6] == run.env[6]))
+      continue;
+    g.runs.push_back(std::move(run));
+    return;
+  }
+
+  if (debugmode)
+    PrintOut(LOG_INFO, "Device: %s, warning digest started, sent in %d seconds\n",
+             run.devname.c_str(), warn_digest_window);
+  group g;
+  g.deadline = run.queued + warn_digest_window;
+  g.runs.push_back(std::move(run));
+  m_groups.push_back(std::move(g));
+}
+
+bool warning_digest::poll(bool flush)
+{
+  time_t now = time(nullptr);
+  for (unsigned i = 0; i < m_groups.size(); ) {
+    if (!(flush || now >= m_groups[i].deadline)) {
+      i++;
+      continue;
+    }
+    std::vector<warning_run> runs = std::move(m_groups[i].runs);
+    m_groups.erase(m_groups.begin() + i);
+    dispatch(runs);
+  }
+  return !m_groups.empty();
+}
+
+void warning_digest::dispatch(std::vector<warning_run> & runs)
+{
+  if (runs.size() == 1) {
+    dispatch_warning_run(std::move(runs.front()));
+    return;
+  }
+
+  // Combine the warnings into one run, keep mailer and address
+  const warning_run & first = runs.front();
+  warning_run digest;
+  digest.env[0] = first.env[0];
+  digest.env[2] = "0";
+  digest.env[3] = first.env[3];
+  digest.env[4] = first.env[4];
+  digest.env[5] = "Digest";
+  digest.env[6] = first.env[6];
+  digest.which = -1;
+  digest.queued = first.queued;
+
+  int nextdays = -1;
+  std::vector<std::string> devnames;
+  for (const warning_run & run : runs) {
+    // SMARTD_MESSAGE: All messages, one per line
+    if (!digest.env[1].empty())
+      digest.env[1] += '\n';
+    digest.env[1] += run.env[1];
+
+    // SMARTD_DEVICESTRING, SMARTD_DEVICEINFO: Each device once
+    if (std::find(devnames.begin(), devnames.end(), run.env[7]) == devnames.end()) {
+      devnames.push_back(run.env[7]);
+      if (!digest.env[7].empty()) {
+        digest.env[7] += ", ";
+        digest.env[10] += '\n';
+      }
+      digest.env[7] += run.env[7];
+      digest.env[10] += run.env[7] + ": " + run.env[10];
+    }
+
+    // SMARTD_NEXTDAYS: Earliest next message
+    if (!run.env[11].empty()) {
+      int days = atoi(run.env[11].c_str());
+      if (nextdays < 0 || days < nextdays)
+        nextdays = days;
+    }
+
+    // Details of each warning: "SMARTD_NAME=VALUE" lines, followed by an empty line
+    for (unsigned i = 1; i < num_warning_env; i++) {
+      if (i == 6 || i == 12)
+        continue; // Same address, no subject
+      digest.digest_text += strprintf("%s=%s\n", warning_env_names[i], run.env[i].c_str());
+    }
+    digest.digest_text += '\n';
+  }
+  if (nextdays >= 0)
+    digest.env[11] = std::to_string(nextdays);
+  digest.devname = digest.env[7];
+
+  // SMARTD_DEVICETYPE, SMARTD_DEVICE: Only set if all warnings are from one device
+  if (devnames.size() == 1) {
+    digest.env[8] = first.env[8];
+    digest.env[9] = first.env[9];
+  }
+
+  PrintOut(LOG_INFO, "Warning digest of %u warnings for %u devices\n",
+           (unsigned)runs.size(), (unsigned)devnames.size());
+  dispatch_warning_run(std::move(digest));
+}
+
+// Dispatch expired warning digests and poll background warning scripts.
+// Returns false if no warning is pending.
+static bool poll_warnings()
+{
+  bool busy = warning_digests.poll();
+  return (warning_scripts.poll() || busy);
+}
+
+// Dispatch all warning digests and wait for background warning scripts.
+static void flush_warnings()
+{
+  warning_digests.poll(true);
+  warning_scripts.drain();
+}
+
+#endif // HAVE_POSIX_API
+
+static void MailWarning(const dev_config & cfg, dev_state & state, int which, const char *fmt, ...)
+  SMARTMON_FORMAT_PRINTF(4, 5);
+
+// If either address or executable path is non-null then send and log
+// a warning email, or execute executable
+static void MailWarning(const dev_config & cfg, dev_state & state, int which, const char *fmt, ...)
+{
+  // See if user wants us to send mail
+  if (cfg.emailaddress.empty() && cfg.emailcmdline.empty())
+    return;
+
+  if (deferred_calls) {
+    va_list ap;
+    va_start(ap, fmt);
+    std::string msg = vstrprintf(fmt, ap);
+    va_end(ap);
+    deferred_calls->push_back([&cfg, &state, which, msg]() {
+      MailWarning(cfg, state, which, "%s", msg.c_str());
+    });
+    return;
+  }
+
+  // Which type of mail are we sending?
+  static const char * const whichfail[] = {
+    "EmailTest",                  // 0
+    "Health",                     // 1
+    "Usage",                      // 2
+    "SelfTest",                   // 3
+    "ErrorCount",                 // 4
+    "FailedHealthCheck",          // 5
+    "FailedReadSmartData",        // 6
+    "FailedReadSmartErrorLog",    // 7
+    "FailedReadSmartSelfTestLog", // 8
+    "FailedOpenDevice",           // 9
+    "CurrentPendingSector",       // 10
+    "OfflineUncorrectableSector", // 11
+    "Temperature"                 // 12
+  };
+  SMARTMON_STATIC_ASSERT(sizeof(whichfail) == SMARTD_NMAIL * sizeof(whichfail[0]));
+  
+  if (!(0 <= which && which < SMARTD_NMAIL)) {
+    PrintOut(LOG_CRIT, "Internal error in MailWarning(): which=%d\n", which);
+    return;
+  }
+  mailinfo * mail = state.maillog + which;
+
+  // Calc current and next interval for warning reminder emails
+  int days, nextdays;
+  if (which == 0)
+    days = nextdays = -1; // EmailTest
+  else switch (cfg.emailfreq) {
+    case emailfreqs::once:
+      days = nextdays = -1; break;
+    case emailfreqs::always:
+      days = nextdays = 0; break;
+    case emailfreqs::daily:
+      days = nextdays = 1; break;
+    case emailfreqs::diminishing:
+      // 0, 1, 2, 3, 4, 5, 6, 7, ... => 1, 2, 4, 8, 16, 32, 32, 32, ...
+      nextdays = 1 << ((unsigned)mail->logged <= 5 ? mail->logged : 5);
+      // 0, 1, 2, 3, 4, 5, 6, 7, ... => 0, 1, 2, 4,  8, 16, 32, 32, ... (0 not used below)
+      days = ((unsigned)mail->logged <= 5 ? nextdays >> 1 : nextdays);
+      break;
+    default:
+      PrintOut(LOG_CRIT, "Internal error in MailWarning(): cfg.emailfreq=%d\n", (int)cfg.emailfreq);
+      return;
+  }
+
+  time_t now = time(nullptr);
+  if (mail->logged) {
+    // Return if no warning reminder email needs to be sent (now)
+    if (days < 0)
+      return; // '-M once' or EmailTest
+    if (days > 0 && now < mail->lastsent + days * 24 * 3600)
+      return; // '-M daily/diminishing' and too early
+  }
+  else {
+    // Record the time of this first email message
+    mail->firstsent = now;
+  }
+
+  // Record the time of this email message
+  mail->lastsent = now;
+
+  // print warning string into message
+  // Note: Message length may reach ~300 characters as device names may be
+  // very long on certain platforms (macOS ~230 characters).
+  // Message length must not exceed email line length limit, see RFC 5322:
+  // "... MUST be no more than 998 characters, ... excluding the CRLF."
+  char message[512];
+  va_list ap;
+  va_start(ap, fmt);
+  vsnprintf(message, sizeof(message), fmt, ap);
+  va_end(ap);
+
+  // replace commas by spaces to separate recipients
+  std::string address = cfg.emailaddress;
+  std::replace(address.begin(), address.end(), ',', ' ');
+
+  // Export information in environment variables that will be useful
+  // for user scripts
+  warning_run run;
+  run.env[0] = cfg.emailcmdline;
+  run.env[1] = message;
+  char dates[DATEANDEPOCHLEN];
+  snprintf(dates, sizeof(dates), "%d", mail->logged);
+  run.env[2] = dates;
+  dateandtimezoneepoch(dates, mail->firstsent);
+  run.env[3] = dates;
+  snprintf(dates, DATEANDEPOCHLEN,"%d", (int)mail->firstsent);
+  run.env[4] = dates;
+  run.env[5] = whichfail[which];
+  run.env[6] = address;
+  run.env[7] = cfg.name;
+
+  // Allow 'smartctl ... -d $SMARTD_DEVICETYPE $SMARTD_DEVICE'
+  run.env[8] = (!cfg.dev_type.empty() ? cfg.dev_type.c_str() : "auto");
+  run.env[9] = cfg.dev_name;
+
+  run.env[10] = cfg.dev_idinfo;
+  dates[0] = 0;
+  if (nextdays >= 0)
+    snprintf(dates, sizeof(dates), "%d", nextdays);
+  run.env[11] = dates;
+  // Avoid false positive recursion detection by smartd_warning.{sh,cmd}
+  run.env[12] = "";
+
+  run.devname = cfg.name;
+  run.which = which;
+  run.queued = now;
+
+#ifdef HAVE_POSIX_API
+  if (warn_digest_window > 0 && which)
+    warning_digests.add(std::move(run));
+  else
+    dispatch_warning_run(std::move(run));
+#else
+  run_warning_script(run);
+#endif
+
   // increment mail sent counter
   mail->logged++;
 }
@@ -1572,6 +2962,18 @@ static void reset_warning_mail(const dev_config & cfg, dev_state & state, int wh
   if (!(0 <= which && which < SMARTD_NMAIL))
     return;
 
+  if (deferred_calls) {
+    // Keep order of changes done by MailWarning()
+    va_list ap;
+    va_start(ap, fmt);
+    std::string msg = vstrprintf(fmt, ap);
+    va_end(ap);
+    deferred_calls->push_back([&cfg, &state, which, msg]() {
+      reset_warning_mail(cfg, state, which, "%s", msg.c_str());
+    });
+    return;
+  }
+
   // Return if no mail sent yet
   mailinfo & mi = state.maillog[which];
   if (!mi.logged)
@@ -1627,6 +3029,12 @@ SMARTMON_DIAGNOSTIC_FORMAT_NONLITERAL_IGNORE
 // Printing function for watching ataprint commands, or losing them
 void smartd_hook::lib_vprintf(const char * fmt, va_list ap)
 {
+  if (deferred_calls) {
+    std::string msg = vstrprintf(fmt, ap);
+    deferred_calls->push_back([msg]() { lib_printf("%s", msg.c_str()); });
+    return;
+  }
+
   // In debugmode==1 mode we will print the library debug output
   if (debugmode && debugmode != 2) {
     FILE * f = stdout;
@@ -1650,7 +3058,15 @@ SMARTMON_DIAGNOSTIC_FORMAT_NONLITERAL_RESTORE
 // This function prints either to stdout or to the syslog as needed.
 static void PrintOut(int priority, const char *fmt, ...){
   va_list ap;
-  
+
+  if (deferred_calls) {
+    va_start(ap, fmt);
+    std::string msg = vstrprintf(fmt, ap);
+    va_end(ap);
+    deferred_calls->push_back([priority, msg]() { PrintOut(priority, "%s", msg.c_str()); });
+    return;
+  }
+
   // get the correct time in syslog()
   FixGlibcTimeZoneBug();
   // initialize variable argument list 
@@ -1867,8 +3283,24 @@ static const char *GetValidArgList(char opt)
   case 'j':
   case 's':
     return "<PATH_PREFIX>, -";
+  case 'F':
+    return "csv, binary";
+  case 'J':
+    return "json[,sync], cbor[,sync]";
+  case 'T':
+    return "files, journal";
+  case 'P':
+    return "<NUMBER_OF_THREADS>";
+  case 'S':
+    return "off, on, controller";
   case 'B':
     return "[+]<FILE_NAME>";
+  case 'O':
+  case 'k':
+  case 'E':
+    return "<FILE_NAME>";
+  case 'X':
+    return "<FILE_NAME>[,<COLUMN>[,<FROM>[,<TO>]]]";
   case 'c':
     return "<FILE_NAME>, -";
   case 'l':
@@ -1883,6 +3315,10 @@ static const char *GetValidArgList(char opt)
   case 'i':
     return "<INTEGER_SECONDS>";
 #ifdef HAVE_POSIX_API
+  case 'G':
+    return "<SECONDS>";
+  case 'W':
+    return "<N>[,<SECONDS>]";
   case 'u':
     return "<USER>[:<GROUP>], -";
 #elif defined(_WIN32)
@@ -1892,6 +3328,10 @@ static const char *GetValidArgList(char opt)
 #ifdef HAVE_LIBCAP_NG
   case 'C':
     return "mail, <no_argument>";
+#endif
+#ifdef __linux__
+  case 'U':
+    return "netlink, <FIFO_NAME>";
 #endif
   default:
     return nullptr;
@@ -1912,6 +3352,12 @@ static void Usage()
   PrintOut(LOG_INFO,"        [default is " SMARTMONTOOLS_ATTRIBUTELOG "MODEL-SERIAL.TYPE.csv]\n");
 #endif
   PrintOut(LOG_INFO,"\n");
+  PrintOut(LOG_INFO,"  -F FORMAT, --attributelog-format=FORMAT\n");
+  PrintOut(LOG_INFO,"        Set format of attribute log files to csv or binary (.bin)\n");
+  PrintOut(LOG_INFO,"        [default is csv]\n\n");
+  PrintOut(LOG_INFO,"  -X FILE[,COLUMN[,FROM[,TO]]], --attributelog-extract=...\n");
+  PrintOut(LOG_INFO,"        Print columns or time series and range of COLUMN from binary\n");
+  PrintOut(LOG_INFO,"        attribute log FILE and exit, FROM/TO is yyyy-mm-dd[THH:MM[:SS]]\n\n");
 #ifdef SMARTMONTOOLS_JSONSTATE
   PrintOut(LOG_INFO,"  -j PREFIX|-, --jsonstate=PREFIX|-\n");
 #else
@@ -1922,6 +3368,11 @@ static void Usage()
   PrintOut(LOG_INFO,"        [default is " SMARTMONTOOLS_JSONSTATE "MODEL-SERIAL.TYPE.json]\n");
 #endif
   PrintOut(LOG_INFO,"\n");
+  PrintOut(LOG_INFO,"  -J FORMAT[,sync], --jsonstate-format=FORMAT[,sync]\n");
+  PrintOut(LOG_INFO,"        Set format of JSON state files to json or cbor (binary),\n");
+  PrintOut(LOG_INFO,"        sync: fsync files and directory [default is json]\n\n");
+  PrintOut(LOG_INFO,"  -O FILE, --jsonstate-snapshot=FILE\n");
+  PrintOut(LOG_INFO,"        Write JSON state of all devices to FILE after each check cycle\n\n");
   PrintOut(LOG_INFO,"  -B [+]FILE, --drivedb=[+]FILE\n");
   PrintOut(LOG_INFO,"        Read and replace [add] drive database from FILE\n");
   PrintOut(LOG_INFO,"        [default is +%s", get_drivedb_path_add());
@@ -1946,6 +3397,15 @@ static void Usage()
   PrintOut(LOG_INFO,"        Display this help and exit\n\n");
   PrintOut(LOG_INFO,"  -i N, --interval=N\n");
   PrintOut(LOG_INFO,"        Set interval between disk checks to N seconds, where N >= 10\n\n");
+  PrintOut(LOG_INFO,"  -k FILE, --scan-cache=FILE\n");
+  PrintOut(LOG_INFO,"        Cache autodetected device types in FILE\n\n");
+  PrintOut(LOG_INFO,"  -S MODE, --stagger=MODE\n");
+  PrintOut(LOG_INFO,"        Spread device checks across the interval, MODE is one of:\n");
+  PrintOut(LOG_INFO,"        off, on, controller [default is off]\n\n");
+#ifdef HAVE_STD_THREAD
+  PrintOut(LOG_INFO,"  -P N, --parallel=N\n");
+  PrintOut(LOG_INFO,"        Check up to N devices in parallel, where 1 <= N <= 64 [default is 1]\n\n");
+#endif
   PrintOut(LOG_INFO,"  -l local[0-7], --logfacility=local[0-7]\n");
 #ifndef _WIN32
   PrintOut(LOG_INFO,"        Use syslog facility local0 - local7 or daemon [default]\n\n");
@@ -1976,6 +3436,16 @@ static void Usage()
   PrintOut(LOG_INFO,"        [default is " SMARTMONTOOLS_SAVESTATES "MODEL-SERIAL.TYPE.state]\n");
 #endif
   PrintOut(LOG_INFO,"\n");
+  PrintOut(LOG_INFO,"  -T FORMAT, --savestates-format=FORMAT\n");
+  PrintOut(LOG_INFO,"        Save disk states to separate files or to one {PREFIX}journal\n");
+  PrintOut(LOG_INFO,"        file, FORMAT is files or journal [default is files]\n\n");
+  PrintOut(LOG_INFO,"  -E FILE, --savestates-extract=FILE\n");
+  PrintOut(LOG_INFO,"        Print the state read from state file FILE and exit\n\n");
+#ifdef __linux__
+  PrintOut(LOG_INFO,"  -U SOURCE, --uevent=SOURCE\n");
+  PrintOut(LOG_INFO,"        Register or unregister DEVICESCAN devices on hotplug events\n");
+  PrintOut(LOG_INFO,"        read from SOURCE, which is netlink or a FIFO\n\n");
+#endif
   PrintOut(LOG_INFO,"  -w NAME, --warnexec=NAME\n");
   PrintOut(LOG_INFO,"        Run executable NAME on warnings\n");
 #ifndef _WIN32
@@ -1984,6 +3454,11 @@ static void Usage()
   PrintOut(LOG_INFO,"        [default is %s/smartd_warning.cmd]\n\n", get_exe_dir().c_str());
 #endif
 #ifdef HAVE_POSIX_API
+  PrintOut(LOG_INFO,"  -W N[,SECONDS], --warn-async=N[,SECONDS]\n");
+  PrintOut(LOG_INFO,"        Run up to N warning scripts in background, kill after SECONDS\n");
+  PrintOut(LOG_INFO,"        [default is to run synchronously, SECONDS is 300]\n\n");
+  PrintOut(LOG_INFO,"  -G SECONDS, --warn-digest=SECONDS\n");
+  PrintOut(LOG_INFO,"        Group warnings raised within SECONDS into one warning script run\n\n");
   PrintOut(LOG_INFO,"  -u USER[:GROUP], --warn-as-user=USER[:GROUP]\n");
   PrintOut(LOG_INFO,"        Run warning script as non-privileged USER\n\n");
 #elif defined(_WIN32)
@@ -2682,20 +4157,20 @@ static int ATADeviceScan(dev_config & cfg, dev_state & state, ata_device * atade
       cfg.state_file = strprintf("%s%s-%s.ata.state", state_path_prefix.c_str(), model, serial);
       // Read previous state
       if (read_dev_state(cfg.state_file.c_str(), state)) {
-        PrintOut(LOG_INFO, "Device: %s, state read from %s\n", name, cfg.state_file.c_str());
+        PrintOut(LOG_INFO, "Device: %s, state read from %s\n", name, state_location(cfg.state_file).c_str());
         // Copy ATA attribute values to temp state
         state.update_temp_state();
       }
     }
     if (!attrlog_path_prefix.empty())
-      cfg.attrlog_file = strprintf("%s%s-%s.ata.csv", attrlog_path_prefix.c_str(), model, serial);
-    if (!json_state_path_prefix.empty()) {
-      cfg.json_state_file = strprintf("%s%s-%s.ata.json", json_state_path_prefix.c_str(), model, serial);
-      // SAT/USB bridges are both ATA and SCSI, match smartctl's get_protocol_info()
-      cfg.json_protocol = (atadev->is_scsi() ? "ATA+SCSI" : "ATA");
-      cfg.json_dev_type = 1;
-    }
+      cfg.attrlog_file = strprintf("%s%s-%s.ata.%s", attrlog_path_prefix.c_str(), model, serial, attrlog_ext());
+    if (!json_state_path_prefix.empty())
+      cfg.json_state_file = strprintf("%s%s-%s.ata.%s", json_state_path_prefix.c_str(), model, serial,
+                                      json_state_ext());
   }
+  // SAT/USB bridges are both ATA and SCSI, match smartctl's get_protocol_info()
+  cfg.json_protocol = (atadev->is_scsi() ? "ATA+SCSI" : "ATA");
+  cfg.json_dev_type = 1;
 
   finish_device_scan(cfg, state);
 
@@ -2959,19 +4434,19 @@ static int SCSIDeviceScan(dev_config & cfg, dev_state & state, scsi_device * scs
       cfg.state_file = strprintf("%s%s-%s-%s.scsi.state", state_path_prefix.c_str(), vendor, model, serial);
       // Read previous state
       if (read_dev_state(cfg.state_file.c_str(), state)) {
-        PrintOut(LOG_INFO, "Device: %s, state read from %s\n", device, cfg.state_file.c_str());
+        PrintOut(LOG_INFO, "Device: %s, state read from %s\n", device, state_location(cfg.state_file).c_str());
         // Copy ATA attribute values to temp state
         state.update_temp_state();
       }
     }
     if (!attrlog_path_prefix.empty())
-      cfg.attrlog_file = strprintf("%s%s-%s-%s.scsi.csv", attrlog_path_prefix.c_str(), vendor, model, serial);
-    if (!json_state_path_prefix.empty()) {
-      cfg.json_state_file = strprintf("%s%s-%s-%s.scsi.json", json_state_path_prefix.c_str(), vendor, model, serial);
-      cfg.json_protocol = "SCSI";
-      cfg.json_dev_type = 2;
-    }
+      cfg.attrlog_file = strprintf("%s%s-%s-%s.scsi.%s", attrlog_path_prefix.c_str(), vendor, model, serial, attrlog_ext());
+    if (!json_state_path_prefix.empty())
+      cfg.json_state_file = strprintf("%s%s-%s-%s.scsi.%s", json_state_path_prefix.c_str(), vendor, model, serial,
+                                      json_state_ext());
   }
+  cfg.json_protocol = "SCSI";
+  cfg.json_dev_type = 2;
 
   finish_device_scan(cfg, state);
 
@@ -3183,17 +4658,17 @@ static int NVMeDeviceScan(dev_config & cfg, dev_state & state, nvme_device * nvm
       cfg.state_file = strprintf("%s%s-%s%s.nvme.state", state_path_prefix.c_str(), model, serial, nsstr);
       // Read previous state
       if (read_dev_state(cfg.state_file.c_str(), state))
-        PrintOut(LOG_INFO, "Device: %s, state read from %s\n", name, cfg.state_file.c_str());
+        PrintOut(LOG_INFO, "Device: %s, state read from %s\n", name, state_location(cfg.state_file).c_str());
     }
     if (!attrlog_path_prefix.empty())
-      cfg.attrlog_file = strprintf("%s%s-%s%s.nvme.csv", attrlog_path_prefix.c_str(), model, serial, nsstr);
-    if (!json_state_path_prefix.empty()) {
-      cfg.json_state_file = strprintf("%s%s-%s%s.nvme.json", json_state_path_prefix.c_str(), model, serial, nsstr);
-      cfg.json_protocol = "NVMe";
-      cfg.json_dev_type = 3;
-      cfg.json_nsid = nsid;
-    }
+      cfg.attrlog_file = strprintf("%s%s-%s%s.nvme.%s", attrlog_path_prefix.c_str(), model, serial, nsstr, attrlog_ext());
+    if (!json_state_path_prefix.empty())
+      cfg.json_state_file = strprintf("%s%s-%s%s.nvme.%s", json_state_path_prefix.c_str(), model, serial, nsstr,
+                                      json_state_ext());
   }
+  cfg.json_protocol = "NVMe";
+  cfg.json_dev_type = 3;
+  cfg.json_nsid = nsid;
 
   finish_device_scan(cfg, state);
 
@@ -3319,9 +4794,76 @@ static void report_self_test_log_changes(const dev_config & cfg, dev_state & sta
 static const char test_type_chars[] = "LncrSCO";
 static const unsigned num_test_types = sizeof(test_type_chars)-1;
 
+// Find ':NNN[-LLL]' in regex for possible offsets and limits
+static void set_test_offsets(dev_config & cfg)
+{
+  const unsigned max_offsets = 1 + num_test_types;
+  cfg.test_offsets.assign(1, test_offset_limit{0, 0}); // offsets/limits[0] == 0 always
+  for (const char * p = cfg.test_regex.get_pattern(); cfg.test_offsets.size() < max_offsets; ) {
+    const char * q = strchr(p, ':');
+    if (!q)
+      break;
+    p = q + 1;
+    unsigned offset = 0, limit = 0; int n1 = -1, n2 = -1, n3 = -1;
+    sscanf(p, "%u%n-%n%u%n", &offset, &n1, &n2, &limit, &n3);
+    if (!(n1 == 3 && (n2 < 0 || (n3 == 3+1+3 && limit > 0))))
+      continue;
+    cfg.test_offsets.push_back(test_offset_limit{offset, limit});
+    p += (n3 > 0 ? n3 : n1);
+  }
+
+  // Share mask table with other devices using the same regex
+  static std::map<std::string, std::weak_ptr<test_hour_mask_table>> tables;
+  std::weak_ptr<test_hour_mask_table> & table = tables[cfg.test_regex.get_pattern()];
+  cfg.test_hour_masks = table.lock();
+  if (!cfg.test_hour_masks) {
+    cfg.test_hour_masks = std::make_shared<test_hour_mask_table>(
+      cfg.test_offsets.size() * num_test_types * 12 * 31 * 7);
+    table = cfg.test_hour_masks;
+  }
+}
+
+// Return bit mask of the hours 0-23 where "T/MM/DD/d/HH[:NNN[-LLL]]" matches
+// the regex for test type index J and offset index I.  Masks are cached per
+// regex and date, so a mask is computed only once for all devices with the
+// same '-s REGEXP' and all later checks.
+static unsigned get_test_hour_mask(const dev_config & cfg,
+  unsigned i, unsigned j, int month, int mday, int weekday)
+{
+  const uint32_t valid = 1U << 24;
+  std::atomic<uint32_t> & entry = (*cfg.test_hour_masks)[
+    (((i * num_test_types + j) * 12 + month-1) * 31 + mday-1) * 7 + weekday-1];
+  uint32_t mask = entry.load(std::memory_order_relaxed);
+  if (mask & valid)
+    return mask & ~valid;
+
+  char pattern[64];
+  const unsigned len = sizeof("S/01/01/1/01") - 1;
+  snprintf(pattern, sizeof(pattern), "%c/%02d/%02d/%1d/00",
+    test_type_chars[j], month, mday, weekday);
+  if (i > 0) {
+    const test_offset_limit & ol = cfg.test_offsets[i];
+    snprintf(pattern + len, sizeof(pattern) - len, ":%03u", ol.offset);
+    if (ol.limit > 0)
+      snprintf(pattern + len + 4, sizeof(pattern) - len - 4, "-%03u", ol.limit);
+  }
+
+  mask = 0;
+  for (int hour = 0; hour < 24; hour++) {
+    pattern[len-2] = '0' + hour / 10; pattern[len-1] = '0' + hour % 10;
+    if (cfg.test_regex.full_match(pattern))
+      mask |= 1U << hour;
+  }
+  entry.store(mask | valid, std::memory_order_relaxed);
+  return mask;
+}
+
 // returns test type if time to do test of type testtype,
 // 0 if not time to do test.
-static char next_scheduled_test(const dev_config & cfg, dev_state & state, time_t usetime = 0)
+// The caller must call FixGlibcTimeZoneBug() before, this is not
+// thread safe.  If SIMULATE is set, no old tests are reported.
+static char next_scheduled_test(const dev_config & cfg, dev_state & state, time_t now,
+                                bool simulate = false)
 {
   // check that self-testing has been requested
   if (cfg.test_regex.empty())
@@ -3332,13 +4874,7 @@ static char next_scheduled_test(const dev_config & cfg, dev_state & state, time_
       && state.not_cap_conveyance && state.not_cap_offline && state.not_cap_selective)
     return 0;
 
-  // since we are about to call localtime(), be sure glibc is informed
-  // of any timezone changes we make.
-  if (!usetime)
-    FixGlibcTimeZoneBug();
-  
   // Is it time for next check?
-  time_t now = (!usetime ? time(nullptr) : usetime);
   if (now < state.scheduled_test_next_check) {
     if (state.scheduled_test_next_check <= now + 3600)
       return 0; // Next check within one hour
@@ -3350,33 +4886,15 @@ static char next_scheduled_test(const dev_config & cfg, dev_state & state, time_
     state.scheduled_test_next_check = now - (3600L*24*90);
   }
 
-  // Find ':NNN[-LLL]' in regex for possible offsets and limits
-  const unsigned max_offsets = 1 + num_test_types;
-  unsigned offsets[max_offsets] = {0, }, limits[max_offsets] = {0, };
-  unsigned num_offsets = 1; // offsets/limits[0] == 0 always
-  for (const char * p = cfg.test_regex.get_pattern(); num_offsets < max_offsets; ) {
-    const char * q = strchr(p, ':');
-    if (!q)
-      break;
-    p = q + 1;
-    unsigned offset = 0, limit = 0; int n1 = -1, n2 = -1, n3 = -1;
-    sscanf(p, "%u%n-%n%u%n", &offset, &n1, &n2, &limit, &n3);
-    if (!(n1 == 3 && (n2 < 0 || (n3 == 3+1+3 && limit > 0))))
-      continue;
-    offsets[num_offsets] = offset; limits[num_offsets] = limit;
-    num_offsets++;
-    p += (n3 > 0 ? n3 : n1);
-  }
-
   // Check interval [state.scheduled_test_next_check, now] for scheduled tests
   char testtype = 0;
   time_t testtime = 0;
   int maxtest = num_test_types-1;
 
   for (time_t t = state.scheduled_test_next_check; ; ) {
-    // Check offset 0 and then all offsets for ':NNN' found above
-    for (unsigned i = 0; i < num_offsets; i++) {
-      unsigned offset = offsets[i], limit = limits[i];
+    // Check offset 0 and then all offsets for ':NNN' found in regex
+    for (unsigned i = 0; i < cfg.test_offsets.size(); i++) {
+      unsigned offset = cfg.test_offsets[i].offset, limit = cfg.test_offsets[i].limit;
       unsigned delay = cfg.test_offset_factor * offset;
       if (0 < limit && limit < delay)
         delay %= limit + 1;
@@ -3396,18 +4914,10 @@ static char next_scheduled_test(const dev_config & cfg, dev_state & state, time_
           default: continue;
         }
         // Try match of "T/MM/DD/d/HH[:NNN]"
-        char pattern[64];
-        snprintf(pattern, sizeof(pattern), "%c/%02d/%02d/%1d/%02d",
-          test_type_chars[j], tms->tm_mon+1, tms->tm_mday, weekday, tms->tm_hour);
-        if (i > 0) {
-          const unsigned len = sizeof("S/01/01/1/01") - 1;
-          snprintf(pattern + len, sizeof(pattern) - len, ":%03u", offset);
-          if (limit > 0)
-            snprintf(pattern + len + 4, sizeof(pattern) - len - 4, "-%03u", limit);
-        }
-        if (cfg.test_regex.full_match(pattern)) {
+        if ((get_test_hour_mask(cfg, i, j, tms->tm_mon+1, tms->tm_mday, weekday)
+             >> tms->tm_hour) & 1) {
           // Test found
-          testtype = pattern[0];
+          testtype = test_type_chars[j];
           testtime = t;
           // Limit further matches to higher priority self-tests
           maxtest = j-1;
@@ -3433,16 +4943,32 @@ static char next_scheduled_test(const dev_config & cfg, dev_state & state, time_
   if (testtype) {
     state.must_write = true;
     // Tell user if an old test was found.
-    if (!usetime && (testtime / 3600) < (now / 3600)) {
-      char datebuf[DATEANDEPOCHLEN]; dateandtimezoneepoch(datebuf, testtime);
-      PrintOut(LOG_INFO, "Device: %s, old test of type %c not run at %s, starting now.\n",
-        cfg.name.c_str(), testtype, datebuf);
+    if (!simulate && (testtime / 3600) < (now / 3600)) {
+      // dateandtimezoneepoch() calls FixGlibcTimeZoneBug(),
+      // so run it by the main thread if deferred
+      std::string name = cfg.name;
+      auto print_old_test = [name, testtype, testtime]() {
+        char datebuf[DATEANDEPOCHLEN]; dateandtimezoneepoch(datebuf, testtime);
+        PrintOut(LOG_INFO, "Device: %s, old test of type %c not run at %s, starting now.\n",
+          name.c_str(), testtype, datebuf);
+      };
+      if (deferred_calls)
+        deferred_calls->push_back(print_old_test);
+      else
+        print_old_test();
     }
   }
 
   return testtype;
 }
 
+static time_t calc_next_wakeuptime(time_t wakeuptime, time_t timenow, int ct)
+{
+  if (timenow < wakeuptime)
+    return wakeuptime;
+  return timenow + ct - (timenow - wakeuptime) % ct;
+}
+
 // Print a list of future tests.
 static void PrintTestSchedule(const dev_config_vector & configs, dev_state_vector & states, const smart_device_list & devices)
 {
@@ -3451,13 +4977,24 @@ static void PrintTestSchedule(const dev_config_vector & configs, dev_state_vecto
     return;
   std::vector<int> testcnts(numdev * num_test_types, 0);
 
-  PrintOut(LOG_INFO, "\nNext scheduled self tests (at most 5 of each type per device):\n");
-
   // FixGlibcTimeZoneBug(); // done in PrintOut()
   time_t now = time(nullptr);
   char datenow[DATEANDEPOCHLEN], date[DATEANDEPOCHLEN];
   dateandtimezoneepoch(datenow, now);
 
+  if (stagger != STAGGER_OFF) {
+    PrintOut(LOG_INFO, "\nStaggered device checks (-S %s):\n",
+             (stagger == STAGGER_CONTROLLER ? "controller" : "on"));
+    for (const auto & cfg : configs) {
+      int ct = (cfg.checktime ? cfg.checktime : checktime);
+      dateandtimezoneepoch(date, calc_next_wakeuptime(cfg.check_offset, now, ct));
+      PrintOut(LOG_INFO, "Device: %s, interval %d, offset %d seconds, next check at %s\n",
+               cfg.name.c_str(), ct, cfg.check_offset, date);
+    }
+  }
+
+  PrintOut(LOG_INFO, "\nNext scheduled self tests (at most 5 of each type per device):\n");
+
   long seconds;
   for (seconds=checktime; seconds<3600L*24*90; seconds+=checktime) {
     // Check for each device whether a test will be run
@@ -3466,7 +5003,7 @@ static void PrintTestSchedule(const dev_config_vector & configs, dev_state_vecto
       const dev_config & cfg = configs.at(i);
       dev_state & state = states.at(i);
       const char * p;
-      char testtype = next_scheduled_test(cfg, state, testtime);
+      char testtype = next_scheduled_test(cfg, state, testtime, true/*simulate*/);
       if (testtype && (p = strchr(test_type_chars, testtype))) {
         unsigned t = (p - test_type_chars);
         // Report at most 5 tests of each type
@@ -3890,12 +5427,13 @@ static void check_attribute(const dev_config & cfg, dev_state & state,
 
 
 static int ATACheckDevice(const dev_config & cfg, dev_state & state, ata_device * atadev,
-                          bool firstpass, bool allow_selftests)
+                          bool firstpass, bool allow_selftests, time_t now)
 {
   // Reset per-cycle JSON freshness flags; only set when corresponding data is
   // refreshed below. JSON output gates each subsection on these to avoid
   // republishing values restored from the persistent .state file as fresh.
   state.json_dirty = false;
+  state.json_fresh = false;
   state.ata_attr_refreshed = false;
   state.ata_errorlog_refreshed = false;
   state.selftest_log_refreshed = false;
@@ -4135,7 +5673,7 @@ static int ATACheckDevice(const dev_config & cfg, dev_state & state, ata_device
   // if the user has asked, and device is capable (or we're not yet
   // sure) check whether a self test should be done now.
   if (allow_selftests && !cfg.test_regex.empty()) {
-    char testtype = next_scheduled_test(cfg, state, false/*!scsi*/);
+    char testtype = next_scheduled_test(cfg, state, now);
     if (testtype)
       DoATASelfTest(cfg, state, atadev, testtype);
   }
@@ -4144,10 +5682,12 @@ static int ATACheckDevice(const dev_config & cfg, dev_state & state, ata_device
   // before the next smartd cycle!
   CloseDevice(atadev, name);
   state.json_dirty = true;
+  state.json_fresh = true;
   return 0;
 }
 
-static int SCSICheckDevice(const dev_config & cfg, dev_state & state, scsi_device * scsidev, bool allow_selftests)
+static int SCSICheckDevice(const dev_config & cfg, dev_state & state, scsi_device * scsidev, bool allow_selftests,
+                           time_t now)
 {
   // Reset per cycle; only positive/negative branches below overwrite this.
   // "Self-test in progress" and unknown non-IE ASC responses stay at 0
@@ -4158,6 +5698,7 @@ static int SCSICheckDevice(const dev_config & cfg, dev_state & state, scsi_devic
   // refreshed below. JSON output gates each subsection on these to avoid
   // republishing values restored from the persistent .state file as fresh.
   state.json_dirty = false;
+  state.json_fresh = false;
   state.ata_attr_refreshed = false;
   state.ata_errorlog_refreshed = false;
   state.selftest_log_refreshed = false;
@@ -4211,7 +5752,7 @@ static int SCSICheckDevice(const dev_config & cfg, dev_state & state, scsi_devic
   }
 
   if (allow_selftests && !cfg.test_regex.empty()) {
-    char testtype = next_scheduled_test(cfg, state);
+    char testtype = next_scheduled_test(cfg, state, now);
     if (testtype)
       DoSCSISelfTest(cfg, state, scsidev, testtype);
   }
@@ -4264,6 +5805,7 @@ static int SCSICheckDevice(const dev_config & cfg, dev_state & state, scsi_devic
 
   CloseDevice(scsidev, name);
   state.json_dirty = true;
+  state.json_fresh = true;
   return 0;
 }
 
@@ -4427,12 +5969,14 @@ static int start_nvme_self_test(const dev_config & cfg, dev_state & state, nvme_
   return 0;
 }
 
-static int NVMeCheckDevice(const dev_config & cfg, dev_state & state, nvme_device * nvmedev, bool firstpass, bool allow_selftests)
+static int NVMeCheckDevice(const dev_config & cfg, dev_state & state, nvme_device * nvmedev, bool firstpass, bool allow_selftests,
+                           time_t now)
 {
   // Reset per-cycle JSON freshness flags; only set when corresponding data is
   // refreshed below. JSON output gates each subsection on these to avoid
   // republishing values restored from the persistent .state file as fresh.
   state.json_dirty = false;
+  state.json_fresh = false;
   state.ata_attr_refreshed = false;
   state.ata_errorlog_refreshed = false;
   state.selftest_log_refreshed = false;
@@ -4522,7 +6066,7 @@ static int NVMeCheckDevice(const dev_config & cfg, dev_state & state, nvme_devic
 
   // Check for test schedule
   char testtype = (allow_selftests && !cfg.test_regex.empty()
-                   ? next_scheduled_test(cfg, state) : 0);
+                   ? next_scheduled_test(cfg, state, now) : 0);
 
   // Read the self-test log if required
   nvme_self_test_log self_test_log{};
@@ -4571,6 +6115,7 @@ static int NVMeCheckDevice(const dev_config & cfg, dev_state & state, nvme_devic
   state.nvme_smartval = smart_log;
   state.attrlog_valid = 3; // NVMe attributes valid
   state.json_dirty = true;
+  state.json_fresh = true;
   return 0;
 }
 
@@ -4651,27 +6196,148 @@ static void do_disable_standby_check(const dev_config_vector & configs, const de
   }
 }
 
+// Checks the SMART status of one device
+// NOW is used for the self-test schedule
+static void CheckDevice(const dev_config & cfg, dev_state & state, smart_device * dev,
+                        bool firstpass, bool allow_selftests, time_t now)
+{
+  if (dev->is_ata())
+    ATACheckDevice(cfg, state, dev->to_ata(), firstpass, allow_selftests, now);
+  else if (dev->is_scsi())
+    SCSICheckDevice(cfg, state, dev->to_scsi(), allow_selftests, now);
+  else if (dev->is_nvme())
+    NVMeCheckDevice(cfg, state, dev->to_nvme(), firstpass, allow_selftests, now);
+}
+
+static void PrintSkipped(const dev_config & cfg)
+{
+  if (debugmode)
+    PrintOut(LOG_INFO, "Device: %s, skipped (interval=%d)\n", cfg.name.c_str(),
+             (cfg.checktime ? cfg.checktime : checktime));
+}
+
+#ifdef HAVE_STD_THREAD
+
+// Checks the SMART status of all devices using up to 'parallel_checks' threads.
+// Devices using the same device file (e.g. ports of a RAID controller) are
+// checked sequentially by the same thread.  All output, warning emails and
+// warning resets are deferred and then done in device order by the main thread.
+static void CheckDevicesParallel(const dev_config_vector & configs, dev_state_vector & states,
+                                 smart_device_list & devices, bool firstpass, bool allow_selftests,
+                                 time_t now)
+{
+  // Group devices by device file name
+  std::vector< std::vector<unsigned> > groups;
+  std::map<std::string, unsigned> group_index;
+  for (unsigned i = 0; i < configs.size(); i++) {
+    if (states.at(i).skip)
+      continue;
+    auto ins = group_index.insert(std::make_pair(configs.at(i).dev_name, (unsigned)groups.size()));
+    if (ins.second)
+      groups.push_back(std::vector<unsigned>());
+    groups[ins.first->second].push_back(i);
+  }
+
+  std::vector<deferred_call_list> outputs(configs.size());
+  std::vector<std::exception_ptr> exceptions(configs.size());
+  std::atomic<unsigned> next_group(0);
+  std::mutex done_mutex;
+  std::condition_variable done_cond;
+  unsigned num_done = 0; // Groups finished, protected by done_mutex
+
+  auto worker = [&]() {
+    for (;;) {
+      unsigned g = next_group++;
+      if (g >= groups.size())
+        break;
+      for (unsigned i : groups[g]) {
+        deferred_calls = &outputs[i];
+        try {
+          CheckDevice(configs.at(i), states.at(i), devices.at(i), firstpass, allow_selftests, now);
+        }
+        catch (...) {
+          exceptions[i] = std::current_exception();
+        }
+        deferred_calls = nullptr;
+      }
+      {
+        std::lock_guard<std::mutex> lock(done_mutex);
+        num_done++;
+      }
+      done_cond.notify_one();
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (unsigned t = 0; t < (unsigned)parallel_checks && t < groups.size(); t++) {
+    try {
+      threads.push_back(std::thread(worker));
+    }
+    catch (const std::system_error &) {
+      break; // Use fewer threads
+    }
+  }
+
+  if (threads.empty())
+    worker();
+  else {
+    // Prevent systemd unit startup timeout while a slow group is checked
+    std::unique_lock<std::mutex> lock(done_mutex);
+    while (num_done < groups.size()) {
+      done_cond.wait_for(lock, std::chrono::seconds(10));
+      lock.unlock();
+      notify_extend_timeout();
+      lock.lock();
+    }
+  }
+  for (std::thread & t : threads)
+    t.join();
+
+  // Replay deferred calls of all devices before the first exception is
+  // rethrown, so warnings of other devices are not lost
+  std::exception_ptr first_exception;
+  for (unsigned i = 0; i < configs.size(); i++) {
+    if (states.at(i).skip) {
+      PrintSkipped(configs.at(i));
+      continue;
+    }
+    for (const auto & call : outputs[i])
+      call();
+    if (exceptions[i] && !first_exception)
+      first_exception = exceptions[i];
+  }
+  if (first_exception)
+    std::rethrow_exception(first_exception);
+}
+
+#endif // HAVE_STD_THREAD
+
 // Checks the SMART status of all ATA and SCSI devices
 static void CheckDevicesOnce(const dev_config_vector & configs, dev_state_vector & states,
                              smart_device_list & devices, bool firstpass, bool allow_selftests)
 {
+  // Since we are about to call localtime(), be sure glibc is informed
+  // of any timezone changes we make.  This modifies the environment,
+  // so it is done here once and not by the worker threads.
+  FixGlibcTimeZoneBug();
+  time_t now = time(nullptr);
+
+#ifdef HAVE_STD_THREAD
+  if (parallel_checks > 1) {
+    CheckDevicesParallel(configs, states, devices, firstpass, allow_selftests, now);
+    notify_extend_timeout();
+  }
+  else
+#endif
   for (unsigned i = 0; i < configs.size(); i++) {
     const dev_config & cfg = configs.at(i);
     dev_state & state = states.at(i);
     if (state.skip) {
-      if (debugmode)
-        PrintOut(LOG_INFO, "Device: %s, skipped (interval=%d)\n", cfg.name.c_str(),
-                 (cfg.checktime ? cfg.checktime : checktime));
+      PrintSkipped(cfg);
       continue;
     }
 
-    smart_device * dev = devices.at(i);
-    if (dev->is_ata())
-      ATACheckDevice(cfg, state, dev->to_ata(), firstpass, allow_selftests);
-    else if (dev->is_scsi())
-      SCSICheckDevice(cfg, state, dev->to_scsi(), allow_selftests);
-    else if (dev->is_nvme())
-      NVMeCheckDevice(cfg, state, dev->to_nvme(), firstpass, allow_selftests);
+    CheckDevice(cfg, state, devices.at(i), firstpass, allow_selftests, now);
 
     // Prevent systemd unit startup timeout when checking many devices on startup
     notify_extend_timeout();
@@ -4724,39 +6390,325 @@ static void ToggleDebugMode()
 }
 #endif
 
-static time_t calc_next_wakeuptime(time_t wakeuptime, time_t timenow, int ct)
+// Schedules the device checks.  The next check times of all devices are
+// kept in a min-heap, so only the devices which are due are visited.
+class check_scheduler
 {
-  if (timenow < wakeuptime)
-    return wakeuptime;
-  return timenow + ct - (timenow - wakeuptime) % ct;
+public:
+  /// Schedule all devices after (re)configuration.
+  void reset(unsigned numdevs);
+
+  /// Set next check times of the devices checked in the last cycle.
+  /// Return time of next due device.
+  time_t schedule(const dev_config_vector & configs, dev_state_vector & states,
+                  time_t timenow);
+
+  /// Set 'skip' flags for next cycle, all devices are checked if CHECK_ALL.
+  void set_due(dev_state_vector & states, time_t timenow, bool check_all);
+
+  /// Forget all check times, e.g. after system clock adjustment.
+  void reset_times(dev_state_vector & states);
+
+  /// Schedule new device with index I after the next check.
+  void add(unsigned i)
+    { m_checked.push_back(i); }
+
+  /// Remove device with index I, renumber the following devices.
+  void remove(unsigned i);
+
+private:
+  typedef std::pair<time_t, unsigned> entry; // (next check time, device index)
+  std::vector<entry> m_heap; // Min-heap
+  std::vector<unsigned> m_checked; // Devices checked in last cycle
+};
+
+void check_scheduler::reset(unsigned numdevs)
+{
+  m_heap.clear();
+  m_checked.clear();
+  for (unsigned i = 0; i < numdevs; i++)
+    m_checked.push_back(i);
 }
 
-static time_t dosleep(time_t wakeuptime, const dev_config_vector & configs,
-  dev_state_vector & states, bool & sigwakeup)
+time_t check_scheduler::schedule(const dev_config_vector & configs, dev_state_vector & states,
+                                 time_t timenow)
 {
-  // If past wake-up-time, compute next wake-up-time
-  time_t timenow = time(nullptr);
-  unsigned n = configs.size();
-  int ct;
-  if (!checktime_min) {
-    // Same for all devices
-    wakeuptime = calc_next_wakeuptime(wakeuptime, timenow, checktime);
-    ct = checktime;
+  for (unsigned i : m_checked) {
+    const dev_config & cfg = configs.at(i);
+    dev_state & state = states.at(i);
+    time_t base = state.wakeuptime;
+    if (!base) // Staggered checks start at fixed times: (time - offset) % interval == 0
+      base = (stagger != STAGGER_OFF ? (time_t)cfg.check_offset : timenow);
+    state.wakeuptime = calc_next_wakeuptime(base, timenow,
+      (cfg.checktime ? cfg.checktime : checktime));
+    m_heap.push_back(entry(state.wakeuptime, i));
+    std::push_heap(m_heap.begin(), m_heap.end(), std::greater<entry>());
+  }
+  m_checked.clear();
+
+  if (m_heap.empty()) // No devices
+    return calc_next_wakeuptime(timenow, timenow, checktime);
+  return m_heap.front().first;
+}
+
+void check_scheduler::set_due(dev_state_vector & states, time_t timenow, bool check_all)
+{
+  for (auto & state : states)
+    state.skip = !check_all;
+  while (!m_heap.empty() && m_heap.front().first <= timenow) {
+    unsigned i = m_heap.front().second;
+    std::pop_heap(m_heap.begin(), m_heap.end(), std::greater<entry>());
+    m_heap.pop_back();
+    states.at(i).skip = false;
+    m_checked.push_back(i);
   }
-  else {
-    // Determine wakeuptime of next device(s)
-    wakeuptime = 0;
-    for (unsigned i = 0; i < n; i++) {
-      const dev_config & cfg = configs.at(i);
-      dev_state & state = states.at(i);
-      if (!state.skip)
-        state.wakeuptime = calc_next_wakeuptime((state.wakeuptime ? state.wakeuptime : timenow),
-          timenow, (cfg.checktime ? cfg.checktime : checktime));
-      if (!wakeuptime || state.wakeuptime < wakeuptime)
-        wakeuptime = state.wakeuptime;
+}
+
+void check_scheduler::reset_times(dev_state_vector & states)
+{
+  for (auto & state : states)
+    state.wakeuptime = 0;
+  reset(states.size());
+}
+
+void check_scheduler::remove(unsigned i)
+{
+  auto heap_end = std::remove_if(m_heap.begin(), m_heap.end(),
+    [i](const entry & e) { return e.second == i; });
+  m_heap.erase(heap_end, m_heap.end());
+  for (auto & e : m_heap) {
+    if (e.second > i)
+      e.second--;
+  }
+  std::make_heap(m_heap.begin(), m_heap.end(), std::greater<entry>());
+
+  m_checked.erase(std::remove(m_checked.begin(), m_checked.end(), i), m_checked.end());
+  for (auto & j : m_checked) {
+    if (j > i)
+      j--;
+  }
+}
+
+#ifdef __linux__
+
+// Kernel uevent for hotplug support
+struct uevent_info
+{
+  std::string action;    // "add", "remove", ...
+  std::string subsystem; // "block", "nvme", ...
+  std::string devtype;   // "disk", "partition", ...
+  std::string devname;   // "sdb", "nvme1", ... (relative to /dev)
+};
+
+// Source of kernel uevents: netlink socket or a FIFO for testing.
+// The FIFO provides one event per line in the format of the netlink
+// messages with blanks instead of null characters, for example:
+// "add@/devices/... ACTION=add SUBSYSTEM=block DEVTYPE=disk DEVNAME=sdb"
+class uevent_source
+{
+public:
+  ~uevent_source()
+    { close(); }
+
+  bool open(const char * name);
+  void close();
+
+  bool is_open() const
+    { return (m_fd >= 0); }
+
+  /// Wait up to SECONDS for events, return true if readable.
+  bool wait(int seconds);
+
+  /// Append all pending events.  Return false if events were lost.
+  bool read_events(std::vector<uevent_info> & events);
+
+private:
+  int m_fd = -1;
+  bool m_netlink = false;
+  std::string m_partial; // Incomplete line from FIFO
+
+  static void parse_event(const char * msg, size_t len, char sep,
+                          std::vector<uevent_info> & events);
+};
+
+bool uevent_source::open(const char * name)
+{
+  close();
+  if (!strcmp(name, "netlink")) {
+    int fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK,
+                    NETLINK_KOBJECT_UEVENT);
+    if (fd < 0)
+      return false;
+    // Large buffer for bursts of events, e.g. JBOD swaps
+    int bufsize = 1024 * 1024;
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &bufsize, sizeof(bufsize));
+    struct sockaddr_nl sa{};
+    sa.nl_family = AF_NETLINK;
+    sa.nl_groups = 1; // Kernel events
+    if (bind(fd, (const struct sockaddr *)&sa, sizeof(sa))) {
+      int err = errno;
+      ::close(fd);
+      errno = err;
+      return false;
+    }
+    m_fd = fd; m_netlink = true;
+    return true;
+  }
+
+  // Open FIFO read/write to avoid EOF if the last writer closes it
+  int fd = ::open(name, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+  if (fd < 0)
+    return false;
+  struct stat st;
+  if (fstat(fd, &st) || !S_ISFIFO(st.st_mode)) {
+    ::close(fd);
+    errno = EINVAL;
+    return false;
+  }
+  m_fd = fd; m_netlink = false;
+  return true;
+}
+
+void uevent_source::close()
+{
+  if (m_fd >= 0)
+    ::close(m_fd);
+  m_fd = -1;
+  m_partial.clear();
+}
+
+bool uevent_source::wait(int seconds)
+{
+  struct pollfd pfd{};
+  pfd.fd = m_fd;
+  pfd.events = POLLIN;
+  return (poll(&pfd, 1, (seconds > 0 ? seconds * 1000 : 0)) > 0);
+}
+
+void uevent_source::parse_event(const char * msg, size_t len, char sep,
+                                std::vector<uevent_info> & events)
+{
+  uevent_info ev;
+  for (size_t i = 0; i < len; ) {
+    const char * p = (const char *)memchr(msg + i, sep, len - i);
+    size_t n = (p ? p - (msg + i) : len - i);
+    std::string field(msg + i, n);
+    i += n + 1;
+
+    // Skip "ACTION@DEVPATH" header and empty fields
+    size_t eq = field.find('=');
+    if (eq == std::string::npos)
+      continue;
+    std::string key = field.substr(0, eq), value = field.substr(eq + 1);
+    if (key == "ACTION")
+      ev.action = value;
+    else if (key == "SUBSYSTEM")
+      ev.subsystem = value;
+    else if (key == "DEVTYPE")
+      ev.devtype = value;
+    else if (key == "DEVNAME")
+      ev.devname = value;
+  }
+  if (!ev.action.empty() && !ev.devname.empty())
+    events.push_back(ev);
+}
+
+bool uevent_source::read_events(std::vector<uevent_info> & events)
+{
+  bool ok = true;
+  char buf[8192];
+  for (;;) {
+    ssize_t n;
+    if (m_netlink) {
+      // Accept kernel messages only
+      struct sockaddr_nl sa{};
+      socklen_t salen = sizeof(sa);
+      n = recvfrom(m_fd, buf, sizeof(buf), 0, (struct sockaddr *)&sa, &salen);
+      if (n > 0 && sa.nl_pid != 0)
+        continue;
+    }
+    else
+      n = read(m_fd, buf, sizeof(buf));
+
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      if (errno == ENOBUFS) {
+        // Socket buffer overrun
+        ok = false;
+        continue;
+      }
+      break; // EAGAIN: no more events
+    }
+    if (n == 0)
+      break;
+
+    if (m_netlink) {
+      parse_event(buf, n, '\0', events);
+      continue;
+    }
+
+    m_partial.append(buf, n);
+    size_t start = 0, nl;
+    while ((nl = m_partial.find('\n', start)) != std::string::npos) {
+      parse_event(m_partial.data() + start, nl - start, ' ', events);
+      start = nl + 1;
+    }
+    m_partial.erase(0, start);
+  }
+  return ok;
+}
+
+// Source of hotplug events, opened after daemon_init()
+static uevent_source uevents;
+
+// DEVICESCAN entry and types for devices added by hotplug events
+static bool hotplug_scan_enabled = false;
+static dev_config hotplug_scan_cfg;
+static smart_devtype_list hotplug_scan_types;
+
+// Relevant hotplug events not yet handled, true if events were lost
+static std::vector<uevent_info> hotplug_events;
+static bool hotplug_events_lost = false;
+
+// Return true if EV adds or removes a disk which may be a DEVICESCAN device.
+// Partitions and other devices are ignored.
+static bool is_hotplug_disk_event(const uevent_info & ev)
+{
+  if (!(ev.action == "add" || ev.action == "remove"))
+    return false;
+  if (!(   (ev.subsystem == "block" && ev.devtype == "disk")
+        || (ev.subsystem == "nvme" && str_starts_with(ev.devname, "nvme"))))
+    return false;
+  return (ev.devname.find('/') == std::string::npos);
+}
+
+// Read pending events and keep the relevant ones for handle_uevents().
+// Return true if relevant events are pending or events were lost.
+static bool read_hotplug_events()
+{
+  std::vector<uevent_info> events;
+  if (!uevents.read_events(events))
+    hotplug_events_lost = true;
+  if (hotplug_scan_enabled) {
+    for (const auto & ev : events) {
+      if (is_hotplug_disk_event(ev))
+        hotplug_events.push_back(ev);
     }
-    ct = checktime_min;
   }
+  return (hotplug_events_lost || !hotplug_events.empty());
+}
+
+#endif // __linux__
+
+static void dosleep(check_scheduler & scheduler, const dev_config_vector & configs,
+  dev_state_vector & states, bool & sigwakeup)
+{
+  // Compute next wake-up-time
+  time_t timenow = time(nullptr);
+  time_t wakeuptime = scheduler.schedule(configs, states, timenow);
+  unsigned n = configs.size();
+  int ct = (checktime_min ? checktime_min : checktime);
 
   notify_wait(wakeuptime, n);
 
@@ -4768,13 +6720,26 @@ static time_t dosleep(time_t wakeuptime, const dev_config_vector & configs,
     if (wakeuptime > timenow + ct) {
       PrintOut(LOG_INFO, "System clock time adjusted to the past. Resetting next wakeup time.\n");
       wakeuptime = timenow + ct;
-      for (auto & state : states)
-        state.wakeuptime = 0;
+      scheduler.reset_times(states);
       no_skip = true;
     }
     
     // Exit sleep when time interval has expired or a signal is received
-    sleep(wakeuptime+addtime-timenow);
+    int sleeptime = wakeuptime+addtime-timenow;
+#ifdef HAVE_POSIX_API
+    // Poll pending warnings once per second
+    if (poll_warnings() && sleeptime > 1)
+      sleeptime = 1;
+#endif
+#ifdef __linux__
+    // Exit sleep also if relevant hotplug events arrive
+    if (uevents.is_open()) {
+      if (uevents.wait(sleeptime) && read_hotplug_events())
+        break;
+    }
+    else
+#endif
+    sleep(sleeptime);
 
 #ifdef _WIN32
     // toggle debug mode?
@@ -4809,13 +6774,7 @@ static time_t dosleep(time_t wakeuptime, const dev_config_vector & configs,
   }
 
   // Check which devices must be skipped in this cycle
-  if (checktime_min) {
-    for (auto & state : states)
-      state.skip = (!no_skip && timenow < state.wakeuptime);
-  }
-  
-  // return adjusted wakeuptime
-  return wakeuptime;
+  scheduler.set_due(states, timenow, no_skip);
 }
 
 // Print out a list of valid arguments for the Directive d
@@ -5224,6 +7183,7 @@ static int ParseToken(char * & token, dev_config & cfg, smart_devtype_list & sca
                  configfile, lineno, name, arg, cfg.test_regex.get_errmsg());
         return -1;
       }
+      set_test_offsets(cfg);
       // Do a bit of sanity checking and warn user if we think that
       // their regexp is "strange". User probably confused about shell
       // glob(3) syntax versus regular expression syntax regexp(7).
@@ -5486,6 +7446,16 @@ static int ParseConfigLine(dev_config_vector & conf_entries, dev_config & defaul
 {
   const char *delim = " \n\t";
 
+  // Keep line with normalized white space to detect changes on reload
+  std::string directives;
+  for (const char * p = line + strspn(line, delim); *p; ) {
+    size_t n = strcspn(p, delim);
+    if (!directives.empty())
+      directives += ' ';
+    directives.append(p, n);
+    p += n; p += strspn(p, delim);
+  }
+
   // get first token: device name. If a comment, skip line
   const char * name = strtok(line, delim);
   if (!name || *name == '#')
@@ -5505,6 +7475,11 @@ static int ParseConfigLine(dev_config_vector & conf_entries, dev_config & defaul
   }
   dev_config & cfg = (retval ? conf_entries.back() : default_conf);
 
+  if (retval)
+    cfg.directives = default_conf.directives + '\n' + directives;
+  else
+    cfg.directives = directives;
+
   cfg.name = name; // Later replaced by dev->get_info().info_name
   cfg.dev_name = name; // If DEVICESCAN later replaced by get->dev_info().dev_name
   cfg.lineno = lineno;
@@ -5760,23 +7735,35 @@ static int parse_options(int argc, char **argv)
 #endif
 
   // Please update GetValidArgList() if you edit shortopts
-  static const char shortopts[] = "c:l:q:dDni:j:p:r:s:A:B:w:Vh?"
+  static const char shortopts[] = "c:l:q:dDni:j:J:O:k:p:P:r:s:S:T:E:A:F:X:B:w:Vh?"
 #if defined(HAVE_POSIX_API) || defined(_WIN32)
                                                           "u:"
 #endif
+#ifdef HAVE_POSIX_API
+                                                          "G:W:"
+#endif
 #ifdef HAVE_LIBCAP_NG
                                                           "C"
+#endif
+#ifdef __linux__
+                                                          "U:"
 #endif
                                                              ;
   // Please update GetValidArgList() if you edit longopts
   struct option longopts[] = {
     { "configfile",     required_argument, 0, 'c' },
     { "jsonstate",      required_argument, 0, 'j' },
+    { "jsonstate-format", required_argument, 0, 'J' },
+    { "jsonstate-snapshot", required_argument, 0, 'O' },
+    { "savestates-format", required_argument, 0, 'T' },
+    { "savestates-extract", required_argument, 0, 'E' },
     { "logfacility",    required_argument, 0, 'l' },
     { "quit",           required_argument, 0, 'q' },
     { "debug",          no_argument,       0, 'd' },
     { "showdirectives", no_argument,       0, 'D' },
     { "interval",       required_argument, 0, 'i' },
+    { "scan-cache",     required_argument, 0, 'k' },
+    { "parallel",       required_argument, 0, 'P' },
 #ifndef _WIN32
     { "no-fork",        no_argument,       0, 'n' },
 #else
@@ -5785,7 +7772,10 @@ static int parse_options(int argc, char **argv)
     { "pidfile",        required_argument, 0, 'p' },
     { "report",         required_argument, 0, 'r' },
     { "savestates",     required_argument, 0, 's' },
+    { "stagger",        required_argument, 0, 'S' },
     { "attributelog",   required_argument, 0, 'A' },
+    { "attributelog-format", required_argument, 0, 'F' },
+    { "attributelog-extract", required_argument, 0, 'X' },
     { "drivedb",        required_argument, 0, 'B' },
     { "warnexec",       required_argument, 0, 'w' },
     { "version",        no_argument,       0, 'V' },
@@ -5796,8 +7786,15 @@ static int parse_options(int argc, char **argv)
 #if defined(HAVE_POSIX_API) || defined(_WIN32)
     { "warn-as-user",   required_argument, 0, 'u' },
 #endif
+#ifdef HAVE_POSIX_API
+    { "warn-async",     required_argument, 0, 'W' },
+    { "warn-digest",    required_argument, 0, 'G' },
+#endif
 #ifdef HAVE_LIBCAP_NG
     { "capabilities",   optional_argument, 0, 'C' },
+#endif
+#ifdef __linux__
+    { "uevent",         required_argument, 0, 'U' },
 #endif
     { 0,                0,                 0, 0   }
   };
@@ -5902,6 +7899,30 @@ static int parse_options(int argc, char **argv)
       }
       checktime = (int)lchecktime;
       break;
+    case 'S':
+      // Staggering of device checks
+      if (!strcmp(optarg, "off"))
+        stagger = STAGGER_OFF;
+      else if (!strcmp(optarg, "on"))
+        stagger = STAGGER_ON;
+      else if (!strcmp(optarg, "controller"))
+        stagger = STAGGER_CONTROLLER;
+      else
+        badarg = true;
+      break;
+    case 'P':
+      // Max number of devices checked in parallel
+      {
+        int n = -1, len = strlen(optarg);
+        if (!(sscanf(optarg, "%d%n", &parallel_checks, &n) == 1 && n == len
+              && 1 <= parallel_checks && parallel_checks <= 64))
+          badarg = true;
+#ifndef HAVE_STD_THREAD
+        else if (parallel_checks > 1)
+          badarg_msg = "Error: parallel checks are not supported on this platform";
+#endif
+      }
+      break;
     case 'r':
       // report IOCTL transactions
       {
@@ -5938,14 +7959,89 @@ static int parse_options(int argc, char **argv)
       // path prefix of persistent state file
       state_path_prefix = (strcmp(optarg, "-") ? optarg : "");
       break;
+    case 'T':
+      // format of persistent state
+      if (!strcmp(optarg, "files"))
+        state_journal_enabled = false;
+      else if (!strcmp(optarg, "journal"))
+        state_journal_enabled = true;
+      else
+        badarg = true;
+      break;
     case 'A':
       // path prefix of attribute log file
       attrlog_path_prefix = (strcmp(optarg, "-") ? optarg : "");
       break;
+    case 'F':
+      // format of attribute log file
+      if (!strcmp(optarg, "csv"))
+        attrlog_format = 0;
+      else if (!strcmp(optarg, "binary"))
+        attrlog_format = 'b';
+      else
+        badarg = true;
+      break;
+    case 'X':
+      // print binary attribute log file
+      {
+        std::vector<std::string> args;
+        for (const char * p = optarg; ; p++) {
+          const char * q = strchr(p, ',');
+          args.emplace_back(p, (q ? q - p : strlen(p)));
+          if (!q)
+            break;
+          p = q;
+        }
+        attrlog_extract_from = attrlog_extract_to = 0;
+        if (   args.size() > 4 || args[0].empty()
+            || (args.size() > 2 && !args[2].empty()
+                && !(attrlog_extract_from = parse_attrlog_time(args[2].c_str())))
+            || (args.size() > 3 && !args[3].empty()
+                && !(attrlog_extract_to = parse_attrlog_time(args[3].c_str())))) {
+          badarg = true;
+          break;
+        }
+        attrlog_extract_file = args[0];
+        attrlog_extract_name = (args.size() > 1 ? args[1] : "");
+      }
+      break;
     case 'j':
       // path prefix of JSON state file
       json_state_path_prefix = (strcmp(optarg, "-") ? optarg : "");
       break;
+    case 'O':
+      // path of JSON snapshot file
+      json_snapshot_path = optarg;
+      break;
+    case 'k':
+      // path of device scan cache file
+      scan_cache_path = optarg;
+      break;
+    case 'E':
+      // print state file
+      state_extract_file = optarg;
+      break;
+    case 'J':
+      // format of JSON state file, optional sync
+      {
+        const char * comma = strchr(optarg, ',');
+        std::string format(optarg, (comma ? comma - optarg : strlen(optarg)));
+        json_state_sync = false;
+        if (comma) {
+          if (strcmp(comma, ",sync")) {
+            badarg = true;
+            break;
+          }
+          json_state_sync = true;
+        }
+        if (format == "json")
+          json_state_format = 0;
+        else if (format == "cbor")
+          json_state_format = 'b';
+        else
+          badarg = true;
+      }
+      break;
     case 'B':
       {
         const char * path = optarg;
@@ -5974,6 +8070,27 @@ static int parse_options(int argc, char **argv)
         warn_as_user = true;
       }
       break;
+    case 'W':
+      // Run warning scripts in background
+      {
+        int n1 = -1, n2 = -1, len = strlen(optarg);
+        warn_async_timeout = 300;
+        if (!(   sscanf(optarg, "%d%n,%d%n", &warn_async_max, &n1, &warn_async_timeout, &n2) >= 1
+              && (n1 == len || n2 == len)
+              && 0 <= warn_async_max && warn_async_max <= 16
+              && 1 <= warn_async_timeout && warn_async_timeout <= 3600))
+          badarg = true;
+      }
+      break;
+    case 'G':
+      // Group warnings into digests
+      {
+        int n = -1, len = strlen(optarg);
+        if (!(   sscanf(optarg, "%d%n", &warn_digest_window, &n) == 1 && n == len
+              && 0 <= warn_digest_window && warn_digest_window <= 3600))
+          badarg = true;
+      }
+      break;
 #elif defined(_WIN32)
     case 'u':
       if (!strcmp(optarg, "restricted"))
@@ -5999,6 +8116,12 @@ static int parse_options(int argc, char **argv)
       else
         badarg = true;
       break;
+#endif
+#ifdef __linux__
+    case 'U':
+      // source of hotplug events
+      uevent_source_name = optarg;
+      break;
 #endif
     case 'h':
       // help: print summary of command-line options
@@ -6067,6 +8190,19 @@ static int parse_options(int argc, char **argv)
     return EXIT_BADCMD;
   }
 
+  // print state file and exit
+  if (!state_extract_file.empty()) {
+    debugmode = 1;
+    return extract_dev_state(state_extract_file.c_str());
+  }
+
+  // print binary attribute log file and exit
+  if (!attrlog_extract_file.empty()) {
+    debugmode = 1;
+    return extract_attrlog(attrlog_extract_file.c_str(), attrlog_extract_name.c_str(),
+                           attrlog_extract_from, attrlog_extract_to);
+  }
+
   // no pidfile in debug mode
   if (debugmode && !pid_file.empty()) {
     debugmode=1;
@@ -6082,7 +8218,9 @@ static int parse_options(int argc, char **argv)
     if (!(   check_abs_path('p', pid_file)
           && check_abs_path('s', state_path_prefix)
           && check_abs_path('A', attrlog_path_prefix)
-          && check_abs_path('j', json_state_path_prefix)))
+          && check_abs_path('j', json_state_path_prefix)
+          && check_abs_path('O', json_snapshot_path)
+          && check_abs_path('k', scan_cache_path)))
       return EXIT_BADCMD;
   }
 #endif
@@ -6120,6 +8258,21 @@ static int parse_options(int argc, char **argv)
 // Function we call if no configuration file was found or if the
 // SCANDIRECTIVE Directive was found.  It makes entries for device
 // names returned by scan_smart_devices() in os_OSNAME.cpp
+// Set names and type of a DEVICESCAN entry
+static void set_scanned_dev_config(dev_config & cfg, const smart_device * dev,
+  const smart_devtype_list & types)
+{
+  cfg.name = dev->get_info().info_name;
+  cfg.dev_name = dev->get_info().dev_name;
+
+  // Set type only if scanning is limited to specific types
+  // This is later used to set SMARTD_DEVICETYPE environment variable
+  if (!types.empty())
+    cfg.dev_type = dev->get_info().dev_type;
+  else // SMARTD_DEVICETYPE=auto
+    cfg.dev_type.clear();
+}
+
 static int MakeConfigEntries(const dev_config & base_cfg,
   dev_config_vector & conf_entries, smart_device_list & scanned_devs,
   const smart_devtype_list & types)
@@ -6147,16 +8300,7 @@ static int MakeConfigEntries(const dev_config & base_cfg,
 
     // Append configuration and update names
     conf_entries.push_back(base_cfg);
-    dev_config & cfg = conf_entries.back();
-    cfg.name = dev->get_info().info_name;
-    cfg.dev_name = dev->get_info().dev_name;
-
-    // Set type only if scanning is limited to specific types
-    // This is later used to set SMARTD_DEVICETYPE environment variable
-    if (!types.empty())
-      cfg.dev_type = dev->get_info().dev_type;
-    else // SMARTD_DEVICETYPE=auto
-      cfg.dev_type.clear();
+    set_scanned_dev_config(conf_entries.back(), dev, types);
   }
   
   return devlist.size();
@@ -6169,6 +8313,9 @@ static int ReadOrMakeConfigEntries(dev_config_vector & conf_entries, smart_devic
   // parse configuration file configfile (normally /etc/smartd.conf)  
   smart_devtype_list scan_types;
   int entries = ParseConfigFile(conf_entries, scan_types);
+#ifdef __linux__
+  hotplug_scan_enabled = false;
+#endif
 
   if (entries < 0) {
     // There was an error reading the configuration file.
@@ -6198,6 +8345,17 @@ static int ReadOrMakeConfigEntries(dev_config_vector & conf_entries, smart_devic
     // make config list of devices to search for
     MakeConfigEntries(first, conf_entries, scanned_devs, scan_types);
 
+#ifdef __linux__
+    // Keep DEVICESCAN entry for hotplug events, never open all devices
+    hotplug_scan_enabled = true;
+    hotplug_scan_cfg = first;
+    hotplug_scan_types.clear();
+    for (const auto & type : scan_types) {
+      if (!str_starts_with(type, "probe"))
+        hotplug_scan_types.push_back(type);
+    }
+#endif
+
     // warn user if scan table found no devices
     if (conf_entries.empty())
       PrintOut(LOG_CRIT,"In the system's table of devices NO devices found to scan\n");
@@ -6208,9 +8366,151 @@ static int ReadOrMakeConfigEntries(dev_config_vector & conf_entries, smart_devic
   return conf_entries.size();
 }
 
+// Device scan cache entry
+struct scan_cache_entry
+{
+  std::string dev_type; // Device type after autodetection
+  std::string protocol; // "ATA", "SCSI" or "NVMe"
+  std::string ident;    // Identity from get_device_ident()
+};
+
+// Device types from previous autodetection, keyed by
+// "DEVICE<TAB>REQUESTED_TYPE".  Written after each (re)registration,
+// only entries of currently registered devices are kept.
+class scan_cache
+{
+public:
+  bool load(const char * path);
+  bool save(const char * path) const;
+
+  const scan_cache_entry * find(const std::string & key) const;
+  void set(const std::string & key, const scan_cache_entry & entry)
+    { m_new_entries[key] = entry; }
+
+  /// Keep old entries of a device which was not registered again.
+  void keep(const std::string & dev_name);
+
+private:
+  std::map<std::string, scan_cache_entry> m_entries, m_new_entries;
+};
+
+bool scan_cache::load(const char * path)
+{
+  m_entries.clear();
+  stdio_file f(path, "r");
+  if (!f) {
+    if (errno != ENOENT)
+      PrintOut(LOG_INFO, "Cannot read scan cache \"%s\": %s\n", path, strerror(errno));
+    return false;
+  }
+
+  char line[1024];
+  while (fgets(line, sizeof(line), f)) {
+    if (line[0] == '#')
+      continue;
+    line[strcspn(line, "\n")] = 0;
+    // DEVICE TYPE DEV_TYPE PROTOCOL IDENT
+    std::vector<std::string> fields;
+    for (const char * p = line; ; ) {
+      const char * t = strchr(p, '\t');
+      fields.push_back(std::string(p, (t ? t - p : strlen(p))));
+      if (!t)
+        break;
+      p = t + 1;
+    }
+    if (!(fields.size() == 5 && !fields[0].empty() && !fields[2].empty() && !fields[4].empty()))
+      continue;
+    scan_cache_entry & e = m_entries[fields[0] + '\t' + fields[1]];
+    e.dev_type = fields[2]; e.protocol = fields[3]; e.ident = fields[4];
+  }
+  return true;
+}
+
+bool scan_cache::save(const char * path) const
+{
+  std::string tmppath = path; tmppath += ".tmp";
+  {
+    stdio_file f(tmppath.c_str(), "w");
+    if (!f) {
+      PrintOut(LOG_INFO, "Cannot create scan cache \"%s\": %s\n", tmppath.c_str(), strerror(errno));
+      return false;
+    }
+    fprintf(f, "# smartd scan cache\n");
+    for (const auto & ei : m_new_entries) {
+      const scan_cache_entry & e = ei.second;
+      fprintf(f, "%s\t%s\t%s\t%s\n", ei.first.c_str(), e.dev_type.c_str(),
+              e.protocol.c_str(), e.ident.c_str());
+    }
+    if (!f.close()) {
+      unlink(tmppath.c_str());
+      return false;
+    }
+  }
+  return replace_file(tmppath.c_str(), path);
+}
+
+void scan_cache::keep(const std::string & dev_name)
+{
+  std::string prefix = dev_name + '\t';
+  for (auto it = m_entries.lower_bound(prefix);
+       it != m_entries.end() && str_starts_with(it->first, prefix.c_str()); ++it)
+    m_new_entries.insert(*it);
+}
+
+const scan_cache_entry * scan_cache::find(const std::string & key) const
+{
+  auto it = m_entries.find(key);
+  return (it != m_entries.end() ? &it->second : nullptr);
+}
+
+// Return protocol name for scan cache
+static const char * get_scan_cache_protocol(smart_device * dev)
+{
+  return (dev->is_ata() ? "ATA" : dev->is_scsi() ? "SCSI" : dev->is_nvme() ? "NVMe" : "");
+}
+
+// Return identity of open device for scan cache and reload, empty on error.
+// Uses a single ATA IDENTIFY, SCSI INQUIRY or NVMe Identify Controller.
+static std::string get_device_ident(smart_device * dev)
+{
+  if (dev->is_ata()) {
+    ata_identify_device drive;
+    if (ata_read_identity(dev->to_ata(), drive, fix_swapped_id))
+      return "";
+    char model[40+1], serial[20+1];
+    format_char_array(model, drive.model);
+    format_char_array(serial, drive.serial_no);
+    unsigned oui = 0; uint64_t unique_id = 0;
+    int naa = ata_get_wwn(&drive, oui, unique_id);
+    if (naa >= 0)
+      return strprintf("%s/%s/%x-%06x-%09" PRIx64, model, serial, naa, oui, unique_id);
+    return strprintf("%s/%s", model, serial);
+  }
+  if (dev->is_scsi()) {
+    uint8_t inqbuf[64] = {0, };
+    if (scsiStdInquiry(dev->to_scsi(), inqbuf, 36) || inqbuf[4] + 5 < 36)
+      return "";
+    char vendor[8+1], model[16+1], rev[4+1];
+    scsi_format_id_string(vendor, &inqbuf[8], 8);
+    scsi_format_id_string(model, &inqbuf[16], 16);
+    scsi_format_id_string(rev, &inqbuf[32], 4);
+    return strprintf("%s/%s/%s", vendor, model, rev);
+  }
+  if (dev->is_nvme()) {
+    nvme_id_ctrl id_ctrl;
+    if (!nvme_read_id_ctrl(dev->to_nvme(), id_ctrl))
+      return "";
+    char model[40+1], serial[20+1];
+    format_char_array(model, id_ctrl.mn);
+    format_char_array(serial, id_ctrl.sn);
+    return strprintf("%s/%s", model, serial);
+  }
+  return "";
+}
+
 // Register one device, return false on error
 static bool register_device(dev_config & cfg, dev_state & state, smart_device_auto_ptr & dev,
-                            const dev_config_vector * prev_cfgs)
+                            const dev_config_vector * prev_cfgs, scan_cache * cache = nullptr)
 {
   bool scanning;
   if (!dev) {
@@ -6233,8 +8533,31 @@ static bool register_device(dev_config & cfg, dev_state & state, smart_device_au
   // Save old info
   smart_device::device_info oldinfo = dev->get_info();
 
-  // Open with autodetect support, may return 'better' device
-  dev.replace( dev->autodetect_open() );
+  // Try device type from scan cache, skip autodetection if identity matches
+  std::string cache_key, cache_ident;
+  bool cache_hit = false;
+  if (cache && (scanning || cfg.dev_type.empty()) && dev->is_scsi()) {
+    cache_key = cfg.dev_name + '\t' + dev->get_req_type();
+    const scan_cache_entry * ce = cache->find(cache_key);
+    if (ce) {
+      smart_device_auto_ptr cdev(smi()->get_smart_device(cfg.dev_name.c_str(), ce->dev_type.c_str()));
+      if (   cdev && cdev->open() && ce->protocol == get_scan_cache_protocol(cdev.get())
+          && (cache_ident = get_device_ident(cdev.get())) == ce->ident) {
+        dev.reset();
+        dev = cdev.release();
+        cache_hit = true;
+      }
+      else if (cdev && cdev->is_open())
+        cdev->close();
+      if (debugmode)
+        PrintOut(LOG_INFO, "Device: %s, scan cache type '%s' %s\n", cfg.name.c_str(),
+                 ce->dev_type.c_str(), (cache_hit ? "used" : "outdated"));
+    }
+  }
+
+  if (!cache_hit)
+    // Open with autodetect support, may return 'better' device
+    dev.replace( dev->autodetect_open() );
 
   // Report if type has changed
   if (oldinfo.dev_type != dev->get_dev_type())
@@ -6248,6 +8571,18 @@ static bool register_device(dev_config & cfg, dev_state & state, smart_device_au
     return false;
   }
 
+  // Get identity for scan cache and reload
+  cfg.dev_ident = (cache_hit ? cache_ident : get_device_ident(dev.get()));
+
+  // Update scan cache
+  if (!cache_key.empty() && !cfg.dev_ident.empty()) {
+    scan_cache_entry ce;
+    ce.dev_type = dev->get_dev_type();
+    ce.protocol = get_scan_cache_protocol(dev.get());
+    ce.ident = cfg.dev_ident;
+    cache->set(cache_key, ce);
+  }
+
   // Update informal name
   cfg.name = dev->get_info().info_name;
   PrintOut(LOG_INFO, "Device: %s, opened\n", cfg.name.c_str());
@@ -6291,21 +8626,99 @@ static bool register_device(dev_config & cfg, dev_state & state, smart_device_au
   return true;
 }
 
+// Spread the check times of all devices with the same interval evenly
+// across the interval.  The offsets only depend on the configuration.
+// With '-S controller', the devices are grouped by device file (e.g. the
+// ports of a RAID controller), member J of a group with N devices is
+// placed at the relative position (J + 0.5) / N of the interval.
+static void set_check_offsets(dev_config_vector & configs)
+{
+  std::map<int, std::vector<unsigned> > intervals;
+  for (unsigned i = 0; i < configs.size(); i++) {
+    const dev_config & cfg = configs.at(i);
+    intervals[cfg.checktime ? cfg.checktime : checktime].push_back(i);
+  }
+
+  for (auto & iv : intervals) {
+    int ct = iv.first;
+    std::vector<unsigned> & devs = iv.second;
+
+    if (stagger == STAGGER_CONTROLLER) {
+      // Group by device file
+      std::map<std::string, unsigned> group_size;
+      for (unsigned i : devs)
+        group_size[configs.at(i).dev_name]++;
+
+      // Sort by position (j + 0.5) / n of member j in its group of size n,
+      // stable to keep configuration order for equal positions
+      struct pos_entry { unsigned i, j, n; };
+      std::vector<pos_entry> pos;
+      std::map<std::string, unsigned> group_member;
+      for (unsigned i : devs) {
+        const std::string & name = configs.at(i).dev_name;
+        pos.push_back({i, group_member[name]++, group_size[name]});
+      }
+      std::stable_sort(pos.begin(), pos.end(),
+        [](const pos_entry & a, const pos_entry & b)
+        { return (2ULL * a.j + 1) * b.n < (2ULL * b.j + 1) * a.n; });
+      for (unsigned k = 0; k < devs.size(); k++)
+        devs[k] = pos[k].i;
+    }
+
+    for (unsigned k = 0; k < devs.size(); k++)
+      configs.at(devs[k]).check_offset = (int)((long long)k * ct / devs.size());
+  }
+}
+
+// Find a device from the previous configuration which could be reused
+// for config entry CFG.  Return its index or -1 if none.
+static int find_unchanged_device(const dev_config & cfg, const std::string & unique_name,
+  const dev_config_vector & old_configs, const std::vector<bool> & old_used)
+{
+  for (unsigned j = 0; j < old_configs.size(); j++) {
+    const dev_config & old_cfg = old_configs.at(j);
+    if (   !old_used[j] && old_cfg.unique_name == unique_name
+        && old_cfg.dev_type == cfg.dev_type && old_cfg.directives == cfg.directives)
+      return j;
+  }
+  return -1;
+}
+
+// Check whether the device still has identity IDENT, keep it closed.
+static bool check_device_ident(smart_device * dev, const std::string & ident)
+{
+  if (ident.empty() || !dev->open())
+    return false;
+  bool ok = (get_device_ident(dev) == ident);
+  dev->close();
+  return ok;
+}
+
 // This function tries devices from conf_entries.  Each one that can be
 // registered is moved onto the [ata|scsi]devices lists and removed
 // from the conf_entries list.
 static bool register_devices(const dev_config_vector & conf_entries, smart_device_list & scanned_devs,
                              dev_config_vector & configs, dev_state_vector & states, smart_device_list & devices)
 {
-  // start by clearing lists/memory of ALL existing devices
-  configs.clear();
+  // Keep devices of previous configuration for reuse if unchanged
+  dev_config_vector old_configs; old_configs.swap(configs);
+  dev_state_vector old_states; old_states.swap(states);
+  smart_device_list old_devices;
+  for (unsigned j = 0; j < devices.size(); j++)
+    old_devices.push_back(devices.release(j));
   devices.clear();
-  states.clear();
+  std::vector<bool> old_used(old_configs.size());
+  std::vector<bool> kept; // true if configs[i] was reused
 
   // Map of already seen non-DEVICESCAN devices (unique_name -> cfg.name)
   typedef std::map<std::string, std::string> prev_unique_names_map;
   prev_unique_names_map prev_unique_names;
 
+  // Read device types from previous autodetection
+  scan_cache cache;
+  if (!scan_cache_path.empty())
+    cache.load(scan_cache_path.c_str());
+
   // Register entries
   for (unsigned i = 0; i < conf_entries.size(); i++) {
     dev_config cfg = conf_entries[i];
@@ -6349,10 +8762,35 @@ static bool register_devices(const dev_config_vector & conf_entries, smart_devic
     // Prevent systemd unit startup timeout when registering many devices
     notify_extend_timeout();
 
+    // Reuse device and state if directives and identity are unchanged
+    int j = find_unchanged_device(cfg, unique_name, old_configs, old_used);
+    if (j >= 0) {
+      old_used[j] = true;
+      const dev_config & old_cfg = old_configs.at(j);
+      if (   old_cfg.scanned == scanning
+          && !(scanning && is_duplicate_dev_idinfo(old_cfg, configs))
+          && check_device_ident(old_devices.at(j), old_cfg.dev_ident)) {
+        PrintOut(LOG_INFO, "Device: %s, unchanged, state kept\n", old_cfg.name.c_str());
+        configs.push_back(old_cfg);
+        configs.back().lineno = cfg.lineno;
+        kept.push_back(true);
+        states.push_back(old_states.at(j));
+        devices.push_back(old_devices.release(j));
+        if (!scan_cache_path.empty())
+          cache.keep(old_cfg.dev_name);
+        if (!scanning)
+          prev_unique_names[unique_name] = cfg.name;
+        continue;
+      }
+      if (debugmode)
+        PrintOut(LOG_INFO, "Device: %s, identity changed or not available\n", old_cfg.name.c_str());
+    }
+
     // Register device
     // If scanning, pass dev_idinfo of previous devices for duplicate check
     dev_state state;
-    if (!register_device(cfg, state, dev, (scanning ? &configs : 0))) {
+    if (!register_device(cfg, state, dev, (scanning ? &configs : 0),
+                         (!scan_cache_path.empty() ? &cache : nullptr))) {
       // if device is explicitly listed and we can't register it, then
       // exit unless the user has specified that the device is removable
       if (!scanning) {
@@ -6369,7 +8807,10 @@ static bool register_devices(const dev_config_vector & conf_entries, smart_devic
     }
 
     // move onto the list of devices
+    cfg.unique_name = unique_name;
+    cfg.scanned = scanning;
     configs.push_back(cfg);
+    kept.push_back(false);
     states.push_back(state);
     devices.push_back(dev);
     if (!scanning)
@@ -6377,23 +8818,284 @@ static bool register_devices(const dev_config_vector & conf_entries, smart_devic
       prev_unique_names[unique_name] = cfg.name;
   }
 
-  // Set minimum check time and factors for staggered tests
+  if (!scan_cache_path.empty())
+    cache.save(scan_cache_path.c_str());
+
+  // Set minimum check time and factors for staggered tests.
+  // Reused devices keep their factor, new devices get the lowest unused ones.
   checktime_min = 0;
+  std::set<unsigned> used_factors;
+  for (unsigned i = 0; i < configs.size(); i++) {
+    if (kept[i] && !configs[i].test_regex.empty())
+      used_factors.insert(configs[i].test_offset_factor);
+  }
   unsigned factor = 0;
-  for (auto & cfg : configs) {
+  for (unsigned i = 0; i < configs.size(); i++) {
+    dev_config & cfg = configs[i];
     if (cfg.checktime && (!checktime_min || checktime_min > cfg.checktime))
       checktime_min = cfg.checktime;
-    if (!cfg.test_regex.empty())
+    if (!kept[i] && !cfg.test_regex.empty()) {
+      while (used_factors.count(factor))
+        factor++;
       cfg.test_offset_factor = factor++;
+    }
   }
   if (checktime_min && checktime_min > checktime)
     checktime_min = checktime;
 
+  // Set offsets for staggered checks
+  if (stagger != STAGGER_OFF)
+    set_check_offsets(configs);
+
   init_disable_standby_check(configs);
   return true;
 }
 
 
+#ifdef __linux__
+
+// Unregister DEVICESCAN devices using device file DEVPATH.
+// Other devices are not affected.
+static void unregister_hotplug_device(const std::string & devpath, check_scheduler & scheduler,
+  dev_config_vector & configs, dev_state_vector & states, smart_device_list & devices)
+{
+  for (unsigned i = configs.size(); i-- > 0; ) {
+    const dev_config & cfg = configs.at(i);
+    if (!(cfg.scanned && cfg.unique_name == devpath))
+      continue;
+
+    // Save state and pending attribute log entry
+    dev_state & state = states.at(i);
+    write_one_dev_state(cfg, state, true);
+    if (state_journal_enabled)
+      commit_dev_state_journal(configs);
+    if (!cfg.attrlog_file.empty() && state.attrlog_valid)
+      write_dev_attrlog(cfg.attrlog_file.c_str(), state);
+
+    PrintOut(LOG_INFO, "Device: %s, removed by hotplug event\n", cfg.name.c_str());
+    configs.erase(configs.begin() + i);
+    states.erase(states.begin() + i);
+    devices.erase(i);
+    scheduler.remove(i);
+  }
+}
+
+// Return the first "/dev/disk/by-id/*" link to device NAME (e.g. "sdb")
+// or to a namespace of NVMe controller NAME (e.g. "nvme1"), empty if none.
+// The order and the links skipped are the same as in scan_smart_devices().
+static std::string find_by_id_link(const char * name, bool nvme)
+{
+  glob_t globbuf{};
+  if (glob("/dev/disk/by-id/*", GLOB_ERR, nullptr, &globbuf)) {
+    globfree(&globbuf);
+    return "";
+  }
+
+  static const regular_expression regex_nsid("[1-9][0-9]*");
+  std::string link;
+  size_t len = strlen(name);
+  for (size_t i = 0; i < globbuf.gl_pathc && link.empty(); i++) {
+    const char * path = globbuf.gl_pathv[i];
+    if (strstr(path, "/nvme-eui."))
+      continue;
+    char dest[256];
+    int sz = readlink(path, dest, sizeof(dest)-1);
+    if (!(0 < sz && sz < (int)sizeof(dest)))
+      continue;
+    dest[sz] = 0;
+    const char * base = strrchr(dest, '/');
+    base = (base ? base + 1 : dest);
+    if (strncmp(base, name, len))
+      continue;
+    // NVMe: "nvmeXnY" namespace of controller "nvmeX"
+    if (nvme ? !(base[len] == 'n' && regex_nsid.full_match(base + len + 1)) : !!base[len])
+      continue;
+    link = path;
+  }
+  globfree(&globbuf);
+  return link;
+}
+
+// Register the DEVICESCAN devices using one of the device files in DEVPATHS.
+// Each device is created directly from its device file, only the device
+// types and names selected by DEVICESCAN are registered.
+// The devices are checked in the next cycle, other devices are not affected.
+static void register_hotplug_devices(const std::set<std::string> & devpaths,
+  check_scheduler & scheduler, dev_config_vector & configs, dev_state_vector & states,
+  smart_device_list & devices, scan_cache * cache)
+{
+  // Device types as selected by scan_smart_devices(), RAID controller scans are skipped
+  bool by_id = false, type_ata = false, type_scsi = false, type_sat = false;
+  bool type_nvme = false, type_raid = false;
+  for (const auto & type : hotplug_scan_types) {
+    if (type == "by-id")
+      by_id = true;
+    else if (type == "ata")
+      type_ata = true;
+    else if (type == "scsi")
+      type_scsi = true;
+    else if (type == "sat")
+      type_sat = true;
+    else if (type == "nvme")
+      type_nvme = true;
+    else if (type == "megaraid" || type == "sssraid")
+      type_raid = true;
+  }
+  if (!(type_ata || type_scsi || type_sat || type_nvme)) {
+    if (type_raid)
+      return;
+    type_ata = type_scsi = type_sat = type_nvme = true;
+  }
+
+  static const regular_expression regex_sd("sd[a-z][a-z]?");
+  static const regular_expression regex_hd("hd[a-t]");
+  static const regular_expression regex_nvme("nvme[0-9][0-9]?");
+
+  unsigned factor = 0;
+  for (const auto & cfg : configs) {
+    if (!cfg.test_regex.empty() && factor <= cfg.test_offset_factor)
+      factor = cfg.test_offset_factor + 1;
+  }
+
+  for (const auto & devpath : devpaths) {
+    // Select device type from name, ignore NVMe namespaces and other devices
+    const char * name = devpath.c_str() + sizeof("/dev/")-1;
+    std::string dev_name = devpath;
+    const char * type;
+    bool nvme = false;
+    if (regex_sd.full_match(name)) {
+      if (!(type_scsi || type_sat))
+        continue;
+      type = (type_scsi && type_sat ? "" : type_scsi ? "scsi" : "sat");
+    }
+    else if (regex_hd.full_match(name)) {
+      if (!type_ata)
+        continue;
+      type = "ata";
+    }
+    else if (regex_nvme.full_match(name)) {
+      if (!type_nvme)
+        continue;
+      type = "nvme";
+      nvme = true;
+    }
+    else
+      continue;
+
+    if (by_id) {
+      // Prefer the unique symlink as DEVICESCAN does,
+      // use broadcast NSID because the link refers to a namespace device
+      std::string link = find_by_id_link(name, nvme);
+      if (!link.empty()) {
+        dev_name = link;
+        if (nvme)
+          type = "nvme,0xffffffff";
+      }
+    }
+
+    smart_device_auto_ptr dev(smi()->get_smart_device(dev_name.c_str(), type));
+    if (!dev) {
+      PrintOut(LOG_INFO, "Device: %s, unable to create device after hotplug event: %s\n",
+               dev_name.c_str(), smi()->get_errmsg());
+      continue;
+    }
+
+    dev_config cfg = hotplug_scan_cfg;
+    set_scanned_dev_config(cfg, dev.get(), hotplug_scan_types);
+    std::string unique_name = smi()->get_unique_dev_name(cfg.dev_name.c_str(), cfg.dev_type.c_str());
+
+    // Ignore if already registered, e.g. from a by-id link
+    bool found = false;
+    for (const auto & c : configs) {
+      if (c.unique_name == unique_name) {
+        found = true;
+        break;
+      }
+    }
+    if (found) {
+      if (debugmode)
+        PrintOut(LOG_INFO, "Device: %s, already registered\n", cfg.name.c_str());
+      continue;
+    }
+
+    dev_state state;
+    if (!register_device(cfg, state, dev, &configs, cache)) {
+      PrintOut(LOG_INFO, "Device: %s, not registered after hotplug event\n", cfg.name.c_str());
+      continue;
+    }
+
+    PrintOut(LOG_INFO, "Device: %s, added by hotplug event\n", cfg.name.c_str());
+    cfg.unique_name = unique_name;
+    cfg.scanned = true;
+    if (!cfg.test_regex.empty())
+      cfg.test_offset_factor = factor++;
+    if (cfg.checktime && (!checktime_min || checktime_min > cfg.checktime))
+      checktime_min = cfg.checktime;
+    configs.push_back(cfg);
+    states.push_back(state);
+    devices.push_back(dev);
+    scheduler.add(configs.size() - 1);
+  }
+}
+
+// Read pending hotplug events and register or unregister the affected
+// DEVICESCAN devices.  Return false if events were lost.
+static bool handle_uevents(check_scheduler & scheduler, dev_config_vector & configs,
+  dev_state_vector & states, smart_device_list & devices)
+{
+  read_hotplug_events();
+  bool ok = !hotplug_events_lost;
+  hotplug_events_lost = false;
+  std::vector<uevent_info> events;
+  events.swap(hotplug_events);
+  if (!ok)
+    PrintOut(LOG_INFO, "Hotplug events lost, rescanning all devices\n");
+  if (!hotplug_scan_enabled)
+    return ok;
+
+  // Last action per device file
+  std::map<std::string, bool> added;
+  for (const auto & ev : events) {
+    if (debugmode)
+      PrintOut(LOG_INFO, "Hotplug event: %s /dev/%s\n", ev.action.c_str(), ev.devname.c_str());
+    added["/dev/" + ev.devname] = (ev.action == "add");
+  }
+
+  if (added.empty())
+    return ok;
+
+  // Read device types from previous autodetection
+  scan_cache cache;
+  if (!scan_cache_path.empty())
+    cache.load(scan_cache_path.c_str());
+
+  std::set<std::string> addpaths;
+  for (const auto & ai : added) {
+    // Remove first, a device may have been replaced
+    unregister_hotplug_device(ai.first, scheduler, configs, states, devices);
+    if (ai.second)
+      addpaths.insert(ai.first);
+  }
+  if (!addpaths.empty())
+    register_hotplug_devices(addpaths, scheduler, configs, states, devices,
+                             (!scan_cache_path.empty() ? &cache : nullptr));
+
+  // Keep entries of all registered devices, drop removed ones
+  if (!scan_cache_path.empty()) {
+    for (const auto & cfg : configs)
+      cache.keep(cfg.dev_name);
+    cache.save(scan_cache_path.c_str());
+  }
+
+  // Set offsets for staggered checks, only new devices use them because
+  // already scheduled devices keep their wakeup time
+  if (stagger != STAGGER_OFF)
+    set_check_offsets(configs);
+  return ok;
+}
+
+#endif // __linux__
+
 // Main program without exception handling
 static int main_worker(int argc, char **argv)
 {
@@ -6427,7 +9129,7 @@ static int main_worker(int argc, char **argv)
 
   // the main loop of the code
   bool firstpass = true, write_states_always = true;
-  time_t wakeuptime = 0;
+  check_scheduler scheduler;
   // assert(status < 0);
   do {
     // Should we (re)read the config file?
@@ -6503,10 +9205,21 @@ static int main_worker(int argc, char **argv)
       // reset signal
       caughtsigHUP=0;
 
+      // Schedule all devices, first check follows now
+      scheduler.reset(configs.size());
+
       // Always write state files after (re)configuration
       write_states_always = true;
     }
 
+#ifdef __linux__
+    // Register or unregister devices on hotplug events,
+    // rescan all devices if events were lost
+    if (!firstpass && uevents.is_open()
+        && !handle_uevents(scheduler, configs, states, devices))
+      caughtsigHUP = 1;
+#endif
+
     // check all devices once,
     // self tests are not started in first pass unless '-q onecheck' is specified
     notify_check((int)devices.size());
@@ -6517,7 +9230,9 @@ static int main_worker(int argc, char **argv)
       write_all_dev_states(configs, states, write_states_always);
     write_states_always = false;
 
-    // Write JSON state files (before attrlogs which clear the dirty flag)
+    // Write JSON snapshot and state files (before attrlogs which clear the dirty flag)
+    if (!json_snapshot_path.empty())
+      write_dev_states_json_snapshot(configs, states);
     if (!json_state_path_prefix.empty())
       write_all_dev_states_json(configs, states);
 
@@ -6525,6 +9240,12 @@ static int main_worker(int argc, char **argv)
     if (!attrlog_path_prefix.empty())
       write_all_dev_attrlogs(configs, states);
 
+#ifdef HAVE_POSIX_API
+    // Send pending warnings before exit or fork()
+    if (quit == QUIT_ONECHECK || (firstpass && !debugmode))
+      flush_warnings();
+#endif
+
     // user has asked us to exit after first check
     if (quit == QUIT_ONECHECK) {
       PrintOut(LOG_INFO,"Started with '-q onecheck' option. All devices successfully checked once.\n"
@@ -6549,14 +9270,23 @@ static int main_worker(int argc, char **argv)
       // Set exit and signal handlers
       install_signal_handlers();
 
-      // Initialize wakeup time to CURRENT time
-      wakeuptime = time(nullptr);
+#ifdef __linux__
+      // Open hotplug event source after file descriptors were closed
+      if (!uevent_source_name.empty()) {
+        if (!uevents.open(uevent_source_name.c_str())) {
+          PrintOut(LOG_CRIT, "Unable to open hotplug event source %s: %s\n",
+                   uevent_source_name.c_str(), strerror(errno));
+          return EXIT_STARTUP;
+        }
+        PrintOut(LOG_INFO, "Listening for hotplug events from %s\n", uevent_source_name.c_str());
+      }
+#endif
 
       firstpass = false;
     }
 
     // sleep until next check time, or a signal arrives
-    wakeuptime = dosleep(wakeuptime, configs, states, write_states_always);
+    dosleep(scheduler, configs, states, write_states_always);
 
   } while (!caughtsigEXIT);
 
@@ -6578,6 +9308,10 @@ static int main_worker(int argc, char **argv)
   if (status < 0)
     status = 0;
 
+#ifdef HAVE_POSIX_API
+  flush_warnings();
+#endif
+
   if (!firstpass) {
     // Loop exited after daemon_init() and write_pid_file()
 
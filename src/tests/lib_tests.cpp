@@ -0,0 +1,482 @@
+/*
+ * tests/lib_tests.cpp - Unit tests and benchmarks of libsmartmon internals
+ *
+ * Home page of code is: https://www.smartmontools.org
+ *
+ * Copyright (C) 2026 Christian Franke
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+// Includes knowndrives.cpp to access its static functions.
+// Usage: lib_tests [-f]
+// Runs all tests and benchmarks.  Benchmarks use small sizes unless
+// '-f' is specified.  Prints "NAME: OK" or "NAME: FAILED" for each test
+// and the run times of each benchmark.  Returns 1 if a test failed.
+
+// Use drivedb.h of the build tree as default database.
+#undef SMARTMONTOOLS_DRIVEDBDIR
+#define SMARTMONTOOLS_DRIVEDBDIR "../lib"
+
+#include "../../lib/knowndrives.cpp"
+
+#include "smartmon/json.h"
+
+#include <chrono>
+
+using namespace smartmon;
+
+// Use the benchmark sizes of the performance requests ('-f')
+static bool full_benchmarks = false;
+
+// Number of failed checks of current test
+static int num_failed = 0;
+
+static void check_failed(const char * expr, int line)
+{
+  printf("lib_tests.cpp(%d): Check failed: %s\n", line, expr);
+  num_failed++;
+}
+
+#define CHECK(expr) ((expr) ? (void)0 : check_failed(#expr, __LINE__))
+
+// Run TEST, print result, return false on failure.
+static bool run_test(const char * name, void (*test)())
+{
+  num_failed = 0;
+  try {
+    test();
+  }
+  catch (const std::exception & ex) {
+    printf("lib_tests.cpp: Exception: %s\n", ex.what());
+    num_failed++;
+  }
+  printf("%s: %s\n", name, (!num_failed ? "OK" : "FAILED"));
+  return !num_failed;
+}
+
+typedef std::chrono::steady_clock bench_clock;
+
+// Return seconds since START.
+static double seconds_since(bench_clock::time_point start)
+{
+  return std::chrono::duration<double>(bench_clock::now() - start).count();
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Drive database lookup
+
+// Version of lookup_drive() without regex cache and index: Linear search,
+// each regex is compiled on each lookup, as before the cache was added.
+static const drive_settings * uncached_lookup_drive(const char * model, const char * firmware)
+{
+  for (unsigned i = 0; i < knowndrives.size(); i++) {
+    if (get_dbentry_type(&knowndrives[i]) != DBENTRY_ATA)
+      continue;
+    regular_expression regex;
+    if (!(regex.compile(knowndrives[i].modelregexp) && regex.full_match(model)))
+      continue;
+    if (!(   !*knowndrives[i].firmwareregexp
+          || (regex.compile(knowndrives[i].firmwareregexp) && regex.full_match(firmware))))
+      continue;
+    return &knowndrives[i];
+  }
+  return nullptr;
+}
+
+// Version of lookup_drive() with regex cache but without index.
+static const drive_settings * linear_lookup_drive(const char * model, const char * firmware)
+{
+  for (unsigned i = 0; i < knowndrives.size(); i++) {
+    if (get_dbentry_type(&knowndrives[i]) != DBENTRY_ATA)
+      continue;
+    if (!knowndrives.match_model(i, model))
+      continue;
+    if (!(   !*knowndrives[i].firmwareregexp
+          || knowndrives.match_firmware(i, firmware)))
+      continue;
+    return &knowndrives[i];
+  }
+  return nullptr;
+}
+
+static void test_drivedb_lookup()
+{
+  knowndrives.append(builtin_knowndrives, builtin_knowndrives_size);
+
+  static const char * const models[] = {
+    "ST4000DM004-2CV104", "WDC WD40EFRX-68N32N0", "Samsung SSD 860 EVO 500GB",
+    "TOSHIBA MG08ACA16TE", "HGST HUS726T4TALA6L4", "INTEL SSDSC2KB480G8",
+    "CT1000MX500SSD1", "KINGSTON SA400S37240G", "ST8000VN004-2M2101",
+    "WDC WD10EZEX-08WN4A0", "Hitachi HDS723020BLA642", "SanDisk SDSSDA240G",
+    "Unknown Model XYZ"
+  };
+  const unsigned num_models = sizeof(models) / sizeof(models[0]);
+  const char firmware[] = "SN01";
+
+  // All lookup functions must return the same entries
+  const drive_settings * found[num_models];
+  for (unsigned i = 0; i < num_models; i++) {
+    found[i] = uncached_lookup_drive(models[i], firmware);
+    CHECK(!found[i] == (i == num_models - 1));
+    CHECK(linear_lookup_drive(models[i], firmware) == found[i]);
+    CHECK(lookup_drive(models[i], firmware) == found[i]);
+  }
+
+  unsigned uncached_lookups = (full_benchmarks ? 100 : 10) * num_models;
+  unsigned lookups = (full_benchmarks ? 10000 : 1000) * num_models;
+
+  bench_clock::time_point start = bench_clock::now();
+  for (unsigned i = 0; i < uncached_lookups; i++)
+    CHECK(uncached_lookup_drive(models[i % num_models], firmware) == found[i % num_models]);
+  double uncached_rate = uncached_lookups / seconds_since(start);
+
+  start = bench_clock::now();
+  for (unsigned i = 0; i < lookups; i++)
+    CHECK(linear_lookup_drive(models[i % num_models], firmware) == found[i % num_models]);
+  double linear_rate = lookups / seconds_since(start);
+
+  start = bench_clock::now();
+  for (unsigned i = 0; i < lookups; i++)
+    CHECK(lookup_drive(models[i % num_models], firmware) == found[i % num_models]);
+  double rate = lookups / seconds_since(start);
+
+  printf("Bench drivedb lookup, %u entries: %.0f/s uncached, %.0f/s cached, %.0f/s indexed\n",
+         knowndrives.size(), uncached_rate, linear_rate, rate);
+}
+
+// Reset drive database to the state at program start.
+static void reset_drive_database()
+{
+  knowndrives.~drive_database();
+  new (&knowndrives) drive_database();
+  drivedb_init_pending = false;
+}
+
+// Drive database use of smartctl per protocol.
+enum startup_protocol { startup_ata, startup_scsi, startup_nvme, num_startup_protocols };
+
+// Run drive database calls of smartctl startup for PROTOCOL.
+// Database is read on first use if LAZY is set.
+static void drivedb_startup(startup_protocol protocol, bool lazy)
+{
+  reset_drive_database();
+  CHECK(init_drive_database(true, lazy));
+
+  if (protocol == startup_ata) {
+    // '-i' or '-a' on ATA device
+    ata_identify_device drive;
+    memset(&drive, 0, sizeof(drive));
+    memset(drive.model, ' ', sizeof(drive.model));
+    memcpy(drive.model, "ST4000DM004-2CV104", 18);
+    memset(drive.fw_rev, ' ', sizeof(drive.fw_rev));
+    memcpy(drive.fw_rev, "0001", 4);
+
+    ata_vendor_attr_defs defs;
+    firmwarebug_defs firmwarebugs;
+    std::string dbversion;
+    CHECK(lookup_drive_apply_presets(&drive, defs, firmwarebugs, dbversion) != nullptr);
+    CHECK(!get_default_attr_defs()[9].name.empty());
+  }
+  // SCSI and NVMe devices do not use the database
+}
+
+static void test_drivedb_startup()
+{
+  static const char * const names[num_startup_protocols] = { "ATA", "SCSI", "NVMe" };
+  unsigned runs = (full_benchmarks ? 100 : 10);
+  double times[num_startup_protocols][2] = { };
+  unsigned db_size = 0, db_custom_size = 0;
+
+  for (int p = 0; p < num_startup_protocols; p++) {
+    for (int lazy = 0; lazy <= 1; lazy++) {
+      for (unsigned i = 0; i < runs; i++) {
+        bench_clock::time_point start = bench_clock::now();
+        drivedb_startup((startup_protocol)p, !!lazy);
+        times[p][lazy] += seconds_since(start);
+      }
+      // Database is only read if used
+      if (p == startup_ata || !lazy) {
+        CHECK(knowndrives.size() > 0);
+        CHECK(!db_size || knowndrives.size() == db_size);
+        db_size = knowndrives.size();
+        db_custom_size = knowndrives.custom_size();
+      }
+      else
+        CHECK(knowndrives.size() == 0 && drivedb_init_pending);
+    }
+  }
+
+  printf("Bench drivedb startup, %u runs, %u entries (%u from file):",
+         runs, db_size, db_custom_size);
+  for (int p = 0; p < num_startup_protocols; p++)
+    printf("%s %s %.3fs eager, %.3fs lazy", (p ? "," : ""), names[p],
+           times[p][0], times[p][1]);
+  printf("\n");
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// JSON tree
+
+// Add ROWS rows of an ATA SMART attribute table as done by smartctl '-A'.
+static void add_attribute_table(json & js, unsigned rows)
+{
+  for (unsigned i = 0; i < rows; i++) {
+    json::ref jref = js["ata_smart_attributes"]["table"][i];
+    jref["id"] = i % 255 + 1;
+    jref["name"] = "Raw_Read_Error_Rate";
+    jref["value"] = 100;
+    jref["worst"] = 99;
+    jref["thresh"] = 6;
+    jref["when_failed"] = "";
+
+    json::ref jreff = jref["flags"];
+    jreff["value"] = 0x000f;
+    jreff["string"] = "POSR-- ";
+    jreff["prefailure"]     = true;
+    jreff["updated_online"] = true;
+    jreff["performance"]    = true;
+    jreff["error_rate"]     = true;
+    jreff["event_count"]    = false;
+    jreff["auto_keep"]      = false;
+
+    jref["raw"]["value"] = i * 1000ULL;
+    jref["raw"]["string"] = std::to_string(i * 1000ULL);
+  }
+}
+
+// Same as add_attribute_table() but each element is set using the full
+// path from the root.
+static void add_attribute_table_full_paths(json & js, unsigned rows)
+{
+  for (unsigned i = 0; i < rows; i++) {
+    js["ata_smart_attributes"]["table"][i]["id"] = i % 255 + 1;
+    js["ata_smart_attributes"]["table"][i]["name"] = "Raw_Read_Error_Rate";
+    js["ata_smart_attributes"]["table"][i]["value"] = 100;
+    js["ata_smart_attributes"]["table"][i]["worst"] = 99;
+    js["ata_smart_attributes"]["table"][i]["thresh"] = 6;
+    js["ata_smart_attributes"]["table"][i]["when_failed"] = "";
+
+    js["ata_smart_attributes"]["table"][i]["flags"]["value"] = 0x000f;
+    js["ata_smart_attributes"]["table"][i]["flags"]["string"] = "POSR-- ";
+    js["ata_smart_attributes"]["table"][i]["flags"]["prefailure"]     = true;
+    js["ata_smart_attributes"]["table"][i]["flags"]["updated_online"] = true;
+    js["ata_smart_attributes"]["table"][i]["flags"]["performance"]    = true;
+    js["ata_smart_attributes"]["table"][i]["flags"]["error_rate"]     = true;
+    js["ata_smart_attributes"]["table"][i]["flags"]["event_count"]    = false;
+    js["ata_smart_attributes"]["table"][i]["flags"]["auto_keep"]      = false;
+
+    js["ata_smart_attributes"]["table"][i]["raw"]["value"] = i * 1000ULL;
+    js["ata_smart_attributes"]["table"][i]["raw"]["string"] = std::to_string(i * 1000ULL);
+  }
+}
+
+static void append_string(const char * str, std::string * out)
+{
+  *out += str;
+}
+
+// Return output of JS in FORMAT.
+static std::string json_output(const json & js, char format, bool sorted = false)
+{
+  json::output_options opts;
+  opts.pretty = true;
+  opts.sorted = sorted;
+  opts.format = format;
+  std::string out;
+  js.output(append_string, &out, opts);
+  return out;
+}
+
+static void test_json_output()
+{
+  json js; js.enable();
+  js["smartctl"]["version"] += {7, 5};
+  js["device"]["name"] = "/dev/sda";
+  js["device"]["type"] = "sat";
+  js["user_capacity"]["bytes"] = 4000787030016ULL;
+  // More than 8 elements, uses the key index
+  for (int i = 20; i > 0; i--)
+    js["many"]["k" + std::to_string(i)] = i;
+  js["many"]["k7"] = 70;
+  add_attribute_table(js, 1);
+
+  CHECK(json_output(js, 0) ==
+    "{\n"
+    "  \"smartctl\": {\n"
+    "    \"version\": [\n"
+    "      7,\n"
+    "      5\n"
+    "    ]\n"
+    "  },\n"
+    "  \"device\": {\n"
+    "    \"name\": \"/dev/sda\",\n"
+    "    \"type\": \"sat\"\n"
+    "  },\n"
+    "  \"user_capacity\": {\n"
+    "    \"bytes\": 4000787030016\n"
+    "  },\n"
+    "  \"many\": {\n"
+    "    \"k20\": 20,\n"
+    "    \"k19\": 19,\n"
+    "    \"k18\": 18,\n"
+    "    \"k17\": 17,\n"
+    "    \"k16\": 16,\n"
+    "    \"k15\": 15,\n"
+    "    \"k14\": 14,\n"
+    "    \"k13\": 13,\n"
+    "    \"k12\": 12,\n"
+    "    \"k11\": 11,\n"
+    "    \"k10\": 10,\n"
+    "    \"k9\": 9,\n"
+    "    \"k8\": 8,\n"
+    "    \"k7\": 70,\n"
+    "    \"k6\": 6,\n"
+    "    \"k5\": 5,\n"
+    "    \"k4\": 4,\n"
+    "    \"k3\": 3,\n"
+    "    \"k2\": 2,\n"
+    "    \"k1\": 1\n"
+    "  },\n"
+    "  \"ata_smart_attributes\": {\n"
+    "    \"table\": [\n"
+    "      {\n"
+    "        \"id\": 1,\n"
+    "        \"name\": \"Raw_Read_Error_Rate\",\n"
+    "        \"value\": 100,\n"
+    "        \"worst\": 99,\n"
+    "        \"thresh\": 6,\n"
+    "        \"when_failed\": \"\",\n"
+    "        \"flags\": {\n"
+    "          \"value\": 15,\n"
+    "          \"string\": \"POSR-- \",\n"
+    "          \"prefailure\": true,\n"
+    "          \"updated_online\": true,\n"
+    "          \"performance\": true,\n"
+    "          \"error_rate\": true,\n"
+    "          \"event_count\": false,\n"
+    "          \"auto_keep\": false\n"
+    "        },\n"
+    "        \"raw\": {\n"
+    "          \"value\": 0,\n"
+    "          \"string\": \"0\"\n"
+    "        }\n"
+    "      }\n"
+    "    ]\n"
+    "  }\n"
+    "}\n");
+
+  std::string sorted = json_output(js, 0, true);
+  CHECK(sorted.find("\"k1\": 1,\n    \"k10\": 10,") != std::string::npos);
+  CHECK(sorted.find("\"k8\": 8,\n    \"k9\": 9\n") != std::string::npos);
+  CHECK(sorted.find("\"ata_smart_attributes\"") < sorted.find("\"device\""));
+  CHECK(json_output(js, 'g').find("json.many.k7 = 70;\n") != std::string::npos);
+
+  // Build and output a large synthetic document
+  unsigned rows = 1900, docs = (full_benchmarks ? 100 : 10);
+  double build_time = 0, output_time = 0;
+  std::string out;
+  for (unsigned i = 0; i < docs; i++) {
+    bench_clock::time_point start = bench_clock::now();
+    json jsb; jsb.enable();
+    add_attribute_table(jsb, rows);
+    build_time += seconds_since(start);
+
+    start = bench_clock::now();
+    std::string outb = json_output(jsb, 0);
+    output_time += seconds_since(start);
+    if (!i)
+      out = outb;
+    else
+      CHECK(outb == out);
+  }
+  CHECK(out.find("\"string\": \"1899000\"") != std::string::npos);
+
+  printf("Bench JSON, %u docs with %u rows, %u bytes: %.3fs build, %.3fs output\n",
+         docs, rows, (unsigned)out.size(), build_time, output_time);
+}
+
+// Output function for streaming output.
+class string_output : public json::output_function
+{
+public:
+  std::string str;
+  virtual void operator()(const char * s) override
+    { str += s; }
+};
+
+static void test_json_ref_chains()
+{
+  // References to elements must stay valid if other elements are added
+  json js; js.enable();
+  json::ref jref = js["device"];
+  jref["name"] = "/dev/sda";
+  json::ref jrefc = js["user_capacity"];
+  jrefc["blocks"] = 7814037168ULL;
+  add_attribute_table(js, 300);
+  jref["type"] = "sat";
+  jrefc["bytes"] = 4000787030016ULL;
+  js["ata_smart_attributes"]["table"][0]["raw"]["value"] = 42;
+  CHECK(json_output(js, 'g').find(
+    "json.device = {};\n"
+    "json.device.name = \"/dev/sda\";\n"
+    "json.device.type = \"sat\";\n"
+    "json.user_capacity = {};\n"
+    "json.user_capacity.blocks = 7814037168;\n"
+    "json.user_capacity.bytes = 4000787030016;\n") != std::string::npos);
+  CHECK(json_output(js, 'g').find(
+    "json.ata_smart_attributes.table[0].raw.value = 42;\n") != std::string::npos);
+
+  // flush() frees nodes, later references must not use stale nodes
+  json jss; jss.enable();
+  string_output out;
+  json::output_options opts;
+  jss.set_streaming(out, opts);
+  jss["a"]["x"] = 1;
+  json::ref jrefb = jss["b"];
+  jrefb["x"] = 2;
+  jss.flush("a");
+  jss["c"]["x"] = 3;
+  jrefb["y"] = 4;
+  jss.output(out, opts);
+  CHECK(out.str == "{\"a\":{\"x\":1},\"b\":{\"x\":2,\"y\":4},\"c\":{\"x\":3}}");
+
+  // Chained references and full paths must produce the same output
+  unsigned rows = 1900, docs = (full_benchmarks ? 100 : 10);
+  double chained_time = 0, full_paths_time = 0;
+  for (unsigned i = 0; i < docs; i++) {
+    bench_clock::time_point start = bench_clock::now();
+    json jsc; jsc.enable();
+    add_attribute_table(jsc, rows);
+    chained_time += seconds_since(start);
+
+    start = bench_clock::now();
+    json jsf; jsf.enable();
+    add_attribute_table_full_paths(jsf, rows);
+    full_paths_time += seconds_since(start);
+
+    if (!i) {
+      CHECK(json_output(jsf, 0) == json_output(jsc, 0));
+      CHECK(json_output(jsf, 0, true) == json_output(jsc, 0, true));
+      CHECK(json_output(jsf, 'y') == json_output(jsc, 'y'));
+      CHECK(json_output(jsf, 'g') == json_output(jsc, 'g'));
+    }
+  }
+
+  printf("Bench JSON refs, %u docs with %u rows: %.3fs full paths, %.3fs chained\n",
+         docs, rows, full_paths_time, chained_time);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+int main(int argc, char ** argv)
+{
+  full_benchmarks = (argc > 1 && !strcmp(argv[1], "-f"));
+
+  bool ok = true;
+  ok &= run_test("drivedb-lookup", test_drivedb_lookup);
+  ok &= run_test("drivedb-startup", test_drivedb_startup);
+  ok &= run_test("json-output", test_json_output);
+  ok &= run_test("json-ref-chains", test_json_ref_chains);
+  return (ok ? 0 : 1);
+}
@@ -0,0 +1,615 @@
+/*
+ * tests/smartd_tests.cpp - Unit tests and benchmarks of smartd internals
+ *
+ * Home page of code is: https://www.smartmontools.org
+ *
+ * Copyright (C) 2026 Christian Franke
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+// Includes smartd.cpp to access its static functions.
+// Usage: smartd_tests [-f]
+// Runs all tests and benchmarks.  Benchmarks use small sizes unless
+// '-f' is specified.  Prints "NAME: OK" or "NAME: FAILED" for each test
+// and the run times of each benchmark.  Returns 1 if a test failed.
+
+#define main smartd_main_unused
+#include "../smartd.cpp"
+#undef main
+
+#include <chrono>
+
+// Use the benchmark sizes of the performance requests ('-f')
+static bool full_benchmarks = false;
+
+// Number of failed checks of current test
+static int num_failed = 0;
+
+static void check_failed(const char * expr, int line)
+{
+  printf("smartd_tests.cpp(%d): Check failed: %s\n", line, expr);
+  num_failed++;
+}
+
+#define CHECK(expr) ((expr) ? (void)0 : check_failed(#expr, __LINE__))
+
+// Run TEST, print result, return false on failure.
+static bool run_test(const char * name, void (*test)())
+{
+  num_failed = 0;
+  try {
+    test();
+  }
+  catch (const std::exception & ex) {
+    printf("smartd_tests.cpp: Exception: %s\n", ex.what());
+    num_failed++;
+  }
+  printf("%s: %s\n", name, (!num_failed ? "OK" : "FAILED"));
+  return !num_failed;
+}
+
+typedef std::chrono::steady_clock bench_clock;
+
+// Return seconds since START.
+static double seconds_since(bench_clock::time_point start)
+{
+  return std::chrono::duration<double>(bench_clock::now() - start).count();
+}
+
+// Fake ATA device which returns IDENTIFY DEVICE data with MODEL and SERIAL.
+class test_ata_device
+: public /*implements*/ ata_device
+{
+public:
+  test_ata_device(const char * dev_name, const char * model, const char * serial)
+    : smart_device(smi(), dev_name, "ata", "ata"),
+      m_model(model), m_serial(serial)
+    { }
+
+  virtual bool is_open() const override
+    { return m_is_open; }
+
+  virtual bool open() override
+    { m_is_open = true; return true; }
+
+  virtual bool close() override
+    { m_is_open = false; return true; }
+
+  virtual bool ata_pass_through(const ata_cmd_in & in, ata_cmd_out & out) override;
+
+private:
+  std::string m_model, m_serial;
+  bool m_is_open = false;
+};
+
+bool test_ata_device::ata_pass_through(const ata_cmd_in & in, ata_cmd_out & /*out*/)
+{
+  if (!(in.in_regs.command == ATA_IDENTIFY_DEVICE && in.size == 512))
+    return set_err(ENOSYS);
+  ata_identify_device & id = *reinterpret_cast<ata_identify_device *>(in.buffer);
+  memset(&id, 0, sizeof(id));
+  memset(id.model, ' ', sizeof(id.model));
+  memcpy(id.model, m_model.data(), std::min(m_model.size(), sizeof(id.model)));
+  memset(id.serial_no, ' ', sizeof(id.serial_no));
+  memcpy(id.serial_no, m_serial.data(), std::min(m_serial.size(), sizeof(id.serial_no)));
+  memset(id.fw_rev, ' ', sizeof(id.fw_rev));
+  // Strings are big-endian words
+  ata_byteswap_id_strings_inplace(id);
+  return true;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Scheduled self-tests
+
+// Fixed start time for reproducible schedules
+static const time_t bench_start_time = 1767225600; // 2026-01-01 00:00 UTC
+
+// Version of next_scheduled_test() without mask cache: One regex match
+// per hour, offset and test type, as before the cache was added.
+static char uncached_next_scheduled_test(const dev_config & cfg, dev_state & state, time_t now)
+{
+  if (now < state.scheduled_test_next_check) {
+    if (state.scheduled_test_next_check <= now + 3600)
+      return 0;
+    state.scheduled_test_next_check = now;
+  }
+  else if (state.scheduled_test_next_check + (3600L*24*90) < now)
+    state.scheduled_test_next_check = now - (3600L*24*90);
+
+  char testtype = 0;
+  int maxtest = num_test_types-1;
+  for (time_t t = state.scheduled_test_next_check; ; ) {
+    for (unsigned i = 0; i < cfg.test_offsets.size(); i++) {
+      unsigned offset = cfg.test_offsets[i].offset, limit = cfg.test_offsets[i].limit;
+      unsigned delay = cfg.test_offset_factor * offset;
+      if (0 < limit && limit < delay)
+        delay %= limit + 1;
+      struct tm tmbuf, * tms = time_to_tm_local(&tmbuf, t - (delay * 3600));
+      int weekday = (tms->tm_wday ? tms->tm_wday : 7);
+      for (int j = 0; j <= maxtest; j++) {
+        char pattern[64];
+        snprintf(pattern, sizeof(pattern), "%c/%02d/%02d/%1d/%02d",
+          test_type_chars[j], tms->tm_mon+1, tms->tm_mday, weekday, tms->tm_hour);
+        if (i > 0) {
+          const unsigned len = sizeof("S/01/01/1/01") - 1;
+          snprintf(pattern + len, sizeof(pattern) - len, ":%03u", offset);
+          if (limit > 0)
+            snprintf(pattern + len + 4, sizeof(pattern) - len - 4, "-%03u", limit);
+        }
+        if (cfg.test_regex.full_match(pattern)) {
+          testtype = test_type_chars[j];
+          maxtest = j-1;
+          break;
+        }
+      }
+    }
+    if (maxtest < 0 || t >= now)
+      break;
+    if ((t += 3600) > now)
+      t = now;
+  }
+
+  struct tm tmbuf, * tmnow = time_to_tm_local(&tmbuf, now);
+  state.scheduled_test_next_check = now + (3600 - tmnow->tm_min*60 - tmnow->tm_sec);
+  return testtype;
+}
+
+// Create NUMDEV configs with the same '-s REGEXP' and staggered offsets.
+static void make_test_configs(unsigned numdev, const char * regex,
+  dev_config_vector & configs, dev_state_vector & states)
+{
+  configs.clear(); states.clear();
+  for (unsigned i = 0; i < numdev; i++) {
+    dev_config cfg;
+    cfg.name = cfg.dev_name = strprintf("/dev/test%u", i);
+    cfg.test_regex.compile(regex);
+    set_test_offsets(cfg);
+    cfg.test_offset_factor = i;
+    configs.push_back(cfg);
+    states.push_back(dev_state());
+  }
+}
+
+// Run the '-q showtests' loop of PrintTestSchedule() for NUMDEV devices,
+// with and without mask cache.  Check that the schedules are the same.
+static void bench_showtests(unsigned numdev)
+{
+  static const char regex[] = "S/../.././(02|14)|L/../../6/03|O/../../[1-5]/(06|18)|C/../01/./04:003";
+  dev_config_vector configs;
+  dev_state_vector states;
+  double times[2] = {0, };
+  std::vector<int> counts[2];
+  for (int cached = 0; cached < 2; cached++) {
+    make_test_configs(numdev, regex, configs, states);
+    counts[cached].assign(numdev * num_test_types, 0);
+    bench_clock::time_point start = bench_clock::now();
+    for (long seconds = checktime; seconds < 3600L*24*90; seconds += checktime) {
+      time_t testtime = bench_start_time + seconds;
+      for (unsigned i = 0; i < numdev; i++) {
+        char testtype = (cached ? next_scheduled_test(configs[i], states[i], testtime, true)
+                                : uncached_next_scheduled_test(configs[i], states[i], testtime));
+        if (testtype)
+          counts[cached][i*num_test_types + (strchr(test_type_chars, testtype) - test_type_chars)]++;
+      }
+    }
+    times[cached] = seconds_since(start);
+  }
+  CHECK(counts[0] == counts[1]);
+  printf("Bench showtests, %u devices, 90 days: %.3fs uncached, %.3fs cached\n",
+         numdev, times[0], times[1]);
+}
+
+// First check of NUMDEV devices after 90 days downtime,
+// with and without mask cache.  The whole interval is
+// searched because there is no 'L' test.
+static void bench_catch_up(unsigned numdev)
+{
+  static const char regex[] = "S/../.././02|n/../../7/(00|12)";
+  dev_config_vector configs;
+  dev_state_vector states;
+  double times[2] = {0, };
+  std::string types[2];
+  for (int cached = 0; cached < 2; cached++) {
+    make_test_configs(numdev, regex, configs, states);
+    time_t now = bench_start_time + 3600L*24*90;
+    bench_clock::time_point start = bench_clock::now();
+    for (unsigned i = 0; i < numdev; i++) {
+      states[i].scheduled_test_next_check = bench_start_time;
+      char testtype = (cached ? next_scheduled_test(configs[i], states[i], now, true)
+                              : uncached_next_scheduled_test(configs[i], states[i], now));
+      types[cached] += (testtype ? testtype : '-');
+    }
+    times[cached] = seconds_since(start);
+  }
+  CHECK(types[0] == types[1]);
+  printf("Bench catch-up, %u devices, 90 days: %.3fs uncached, %.3fs cached\n",
+         numdev, times[0], times[1]);
+}
+
+static void test_scheduled_tests()
+{
+  bench_showtests(full_benchmarks ? 1000 : 50);
+  bench_catch_up(full_benchmarks ? 1000 : 50);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Check scheduler
+
+// Add a device with check interval CT.
+static void add_test_device(int ct, dev_config_vector & configs, dev_state_vector & states)
+{
+  dev_config cfg;
+  cfg.checktime = ct;
+  configs.push_back(cfg);
+  states.push_back(dev_state());
+}
+
+// Remove device I, as unregister_hotplug_device() does.
+static void remove_test_device(unsigned i, check_scheduler & scheduler,
+  dev_config_vector & configs, dev_state_vector & states)
+{
+  configs.erase(configs.begin() + i);
+  states.erase(states.begin() + i);
+  scheduler.remove(i);
+}
+
+static void test_check_scheduler()
+{
+  dev_config_vector configs;
+  dev_state_vector states;
+  for (int ct : {100, 200, 300, 400})
+    add_test_device(ct, configs, states);
+
+  check_scheduler scheduler;
+  scheduler.reset(configs.size());
+  CHECK(scheduler.schedule(configs, states, 1000) == 1100);
+
+  // Remove device waiting in heap: [0]=1100, [1]=1300, [2]=1400
+  remove_test_device(1, scheduler, configs, states);
+  scheduler.set_due(states, 1200, false);
+  CHECK(!states[0].skip && states[1].skip && states[2].skip);
+  CHECK(scheduler.schedule(configs, states, 1200) == 1300);
+  CHECK(states[0].wakeuptime == 1300);
+
+  // Remove device checked in last cycle: [0]=checked, [1]=1400
+  scheduler.set_due(states, 1300, false);
+  CHECK(!states[0].skip && !states[1].skip && states[2].skip);
+  remove_test_device(0, scheduler, configs, states);
+  CHECK(scheduler.schedule(configs, states, 1300) == 1400);
+  CHECK(states[0].wakeuptime == 1600 && states[1].wakeuptime == 1400);
+
+  // Add device, first check after the next check of the others
+  add_test_device(50, configs, states);
+  scheduler.add(2);
+  scheduler.set_due(states, 1400, false);
+  CHECK(states[0].skip && !states[1].skip && states[2].skip);
+  CHECK(scheduler.schedule(configs, states, 1400) == 1450);
+  CHECK(states[1].wakeuptime == 1800 && states[2].wakeuptime == 1450);
+
+  scheduler.set_due(states, 1600, false);
+  CHECK(!states[0].skip && states[1].skip && !states[2].skip);
+  CHECK(scheduler.schedule(configs, states, 1600) == 1650);
+
+  // Remove all, no device left
+  for (unsigned i = configs.size(); i-- > 0; )
+    remove_test_device(i, scheduler, configs, states);
+  scheduler.set_due(states, 2000, false);
+  CHECK(scheduler.schedule(configs, states, 2000) == 2000 + checktime);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Reuse of devices on reload
+
+// Add a device as registered by a previous configuration.
+static void add_old_device(const char * name, const char * directives,
+  const char * model, const char * serial, unsigned factor,
+  dev_config_vector & configs, dev_state_vector & states, smart_device_list & devices)
+{
+  dev_config cfg;
+  cfg.name = cfg.dev_name = name;
+  cfg.dev_type = "ata";
+  cfg.directives = directives;
+  cfg.unique_name = smi()->get_unique_dev_name(name, "ata");
+  cfg.dev_ident = strprintf("%s/%s", model, serial);
+  cfg.test_regex.compile("S/../.././02");
+  set_test_offsets(cfg);
+  cfg.test_offset_factor = factor;
+  configs.push_back(cfg);
+  dev_state state;
+  state.tempmax = 40 + factor;
+  states.push_back(state);
+  devices.push_back(new test_ata_device(name, model, serial));
+}
+
+// Add a config entry as read from smartd.conf.
+static void add_conf_entry(const char * name, const char * directives, dev_config_vector & conf_entries)
+{
+  dev_config cfg;
+  cfg.name = cfg.dev_name = name;
+  cfg.dev_type = "ata";
+  cfg.directives = directives;
+  cfg.removable = true;
+  cfg.lineno = conf_entries.size() + 1;
+  cfg.test_regex.compile("S/../.././02");
+  set_test_offsets(cfg);
+  conf_entries.push_back(cfg);
+}
+
+static void test_find_unchanged_device()
+{
+  dev_config_vector old_configs;
+  dev_state_vector old_states;
+  smart_device_list old_devices;
+  add_old_device("/dev/test_a", "-a", "Model", "A", 0, old_configs, old_states, old_devices);
+  add_old_device("/dev/test_a", "-a", "Model", "B", 1, old_configs, old_states, old_devices);
+  add_old_device("/dev/test_b", "-a -s L/../../7/03", "Model", "C", 2, old_configs, old_states, old_devices);
+
+  dev_config cfg = old_configs[0];
+  std::vector<bool> used(old_configs.size());
+  CHECK(find_unchanged_device(cfg, cfg.unique_name, old_configs, used) == 0);
+  used[0] = true;
+  CHECK(find_unchanged_device(cfg, cfg.unique_name, old_configs, used) == 1);
+  used[1] = true;
+  CHECK(find_unchanged_device(cfg, cfg.unique_name, old_configs, used) == -1);
+
+  cfg = old_configs[2];
+  CHECK(find_unchanged_device(cfg, cfg.unique_name, old_configs, used) == 2);
+  cfg.directives = "-a";
+  CHECK(find_unchanged_device(cfg, cfg.unique_name, old_configs, used) == -1);
+  cfg = old_configs[2]; cfg.dev_type = "sat";
+  CHECK(find_unchanged_device(cfg, cfg.unique_name, old_configs, used) == -1);
+
+  smart_device * dev = old_devices.at(0);
+  CHECK(check_device_ident(dev, "Model/A"));
+  CHECK(!dev->is_open());
+  CHECK(!check_device_ident(dev, "Model/B"));
+  CHECK(!check_device_ident(dev, ""));
+}
+
+static void test_register_devices_reload()
+{
+  // Previous configuration
+  dev_config_vector configs;
+  dev_state_vector states;
+  smart_device_list devices;
+  add_old_device("/dev/test_a", "-a", "Model", "A", 0, configs, states, devices);
+  add_old_device("/dev/test_b", "-a", "Model", "B", 1, configs, states, devices);
+  add_old_device("/dev/test_c", "-a", "Model", "C", 2, configs, states, devices);
+  add_old_device("/dev/test_d", "-a", "Model", "D", 3, configs, states, devices);
+  smart_device * old_d = devices.at(3);
+
+  // Disk of test_a replaced by other disk
+  configs.at(0).dev_ident = "Model/X";
+
+  // New configuration: test_a unchanged, test_b changed, test_c removed,
+  // test_d unchanged, test_e added.  The non existent devices are not
+  // available and ignored due to '-d removable'.
+  dev_config_vector conf_entries;
+  add_conf_entry("/dev/test_a", "-a", conf_entries);
+  add_conf_entry("/dev/test_b", "-a -s L/../../7/03", conf_entries);
+  add_conf_entry("/dev/test_d", "-a", conf_entries);
+  add_conf_entry("/dev/test_e", "-a", conf_entries);
+  smart_device_list scanned_devs;
+  CHECK(register_devices(conf_entries, scanned_devs, configs, states, devices));
+
+  // Only test_d is kept with its state, lineno is updated
+  CHECK(configs.size() == 1 && states.size() == 1 && devices.size() == 1);
+  CHECK(configs.at(0).name == "/dev/test_d");
+  CHECK(configs.at(0).lineno == 3);
+  CHECK(configs.at(0).test_offset_factor == 3);
+  CHECK(states.at(0).tempmax == 43);
+  CHECK(devices.at(0) == old_d);
+
+  // Reload again with test_c registered in between: the factors of the
+  // kept devices are not renumbered, even if lower ones are unused
+  add_old_device("/dev/test_c", "-a", "Model", "C", 7, configs, states, devices);
+
+  conf_entries.clear();
+  add_conf_entry("/dev/test_c", "-a", conf_entries);
+  add_conf_entry("/dev/test_d", "-a", conf_entries);
+  CHECK(register_devices(conf_entries, scanned_devs, configs, states, devices));
+  CHECK(configs.size() == 2);
+  CHECK(configs.at(0).name == "/dev/test_c" && configs.at(0).test_offset_factor == 7);
+  CHECK(configs.at(1).name == "/dev/test_d" && configs.at(1).test_offset_factor == 3);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// State files
+
+// Regex of the previous state file parser.
+static const regular_expression & old_state_line_regex()
+{
+  static const regular_expression regex(
+    "^ *"
+     "((temperature-min)|(temperature-max)|(self-test-errors)"
+     "|(self-test-last-err-hour)|(scheduled-test-next-check)"
+     "|(selective-test-last-start)|(selective-test-last-end)|(ata-error-count)"
+     "|(mail\\.([0-9]+)\\.((count)|(first-sent-time)|(last-sent-time)))"
+     "|(ata-smart-attribute\\.([0-9]+)\\.((id)|(val)|(worst)|(raw)|(resvd)))"
+     "|(nvme-err-log-entries)|(nvme-available-spare)"
+     "|(nvme-percentage-used)|(nvme-media-errors))"
+     " *= *([0-9]+)[ \n]*$"
+  );
+  return regex;
+}
+
+// Return number of lines of TEXT matched by the previous regex.
+// Lower bound of the run time of the previous parser.
+static int old_parse_dev_state_text(const char * text)
+{
+  const regular_expression & regex = old_state_line_regex();
+  regular_expression::match_range match[1+28];
+  int good = 0;
+  for (const char * p = text; *p; ) {
+    size_t len = strcspn(p, "\n");
+    std::string line(p, len);
+    p += len + (p[len] ? 1 : 0);
+    if (regex.execute(line.c_str(), match) && match[28].rm_so >= 0)
+      good++;
+  }
+  return good;
+}
+
+// Return the state file of an ATA device with NUMATTR attributes.
+static std::string make_test_state_text(unsigned seed, int numattr)
+{
+  persistent_dev_state state;
+  state.tempmin = 20 + seed % 10; state.tempmax = 40 + seed % 20;
+  state.selflogcount = 1; state.selfloghour = 12345 + seed;
+  state.scheduled_test_next_check = bench_start_time + seed;
+  state.ataerrorcount = seed % 3;
+  state.maillog[0].logged = 2;
+  state.maillog[0].firstsent = bench_start_time;
+  state.maillog[0].lastsent = bench_start_time + 86400;
+  for (int i = 0; i < numattr; i++) {
+    auto & pa = state.ata_attributes[i];
+    pa.id = i + 1; pa.val = pa.worst = 100; pa.raw = seed * 1000 + i;
+  }
+  return format_dev_state(state);
+}
+
+static void test_state_files()
+{
+  unsigned numfiles = (full_benchmarks ? 10000 : 1000);
+  std::vector<std::string> texts;
+  int numlines = 0;
+  for (unsigned i = 0; i < numfiles; i++) {
+    texts.push_back(make_test_state_text(i, 30));
+    numlines += std::count(texts[i].begin(), texts[i].end(), '\n');
+  }
+
+  // Parse back, compare with the regex of the previous parser
+  bench_clock::time_point start = bench_clock::now();
+  int old_good = 0;
+  for (const auto & text : texts)
+    old_good += old_parse_dev_state_text(text.c_str());
+  double old_time = seconds_since(start);
+
+  start = bench_clock::now();
+  int good = 0;
+  for (unsigned i = 0; i < numfiles; i++) {
+    persistent_dev_state state;
+    if (parse_dev_state_text("test", texts[i].c_str(), state))
+      good++;
+    if (i == numfiles - 1)
+      CHECK(format_dev_state(state) == texts[i]);
+  }
+  double new_time = seconds_since(start);
+
+  CHECK(good == (int)numfiles);
+  CHECK(old_good == numlines);
+  printf("Bench state files, %u files, %d lines: %.3fs regex match only, %.3fs parse\n",
+         numfiles, numlines, old_time, new_time);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// JSON state files
+
+// Write JSON state file for one device as before json_state_writer was added:
+// New json tree, stdio file, rename of each file.
+static bool old_write_dev_state_json(const char * path, const dev_config & cfg,
+                                     const dev_state & state)
+{
+  std::string tmppath = path; tmppath += '~';
+  stdio_file f(tmppath.c_str(), "w");
+  if (!f)
+    return false;
+
+  json js;
+  js.enable();
+  js["json_format_version"] += {1, 0};
+  set_dev_state_json(js, cfg, state, time(nullptr));
+
+  json::output_options opts;
+  opts.pretty = true;
+  std::string buf;
+  string_json_output out(buf);
+  js.output(out, opts);
+  if (!(fwrite(buf.data(), 1, buf.size(), f) == buf.size() && f.close()))
+    return false;
+  return replace_file(tmppath.c_str(), path);
+}
+
+static void test_json_state_files()
+{
+  unsigned numdev = (full_benchmarks ? 1000 : 100);
+  const int numcycles = 5;
+  static const char dir[] = "smartd_tests.tmp";
+#ifdef _WIN32
+  mkdir(dir);
+#else
+  mkdir(dir, 0755);
+#endif
+  json_state_path_prefix = strprintf("%s/test-", dir);
+
+  // ATA devices with 30 attributes
+  dev_config_vector configs;
+  dev_state_vector states;
+  for (unsigned i = 0; i < numdev; i++) {
+    dev_config cfg;
+    cfg.name = cfg.dev_name = strprintf("/dev/test%u", i);
+    cfg.json_protocol = "ATA";
+    cfg.json_dev_type = 1;
+    cfg.json_state_file = strprintf("%s%u.ata.json", json_state_path_prefix.c_str(), i);
+    configs.push_back(cfg);
+    dev_state state;
+    state.temperature = 30 + i % 20;
+    state.ata_attr_refreshed = true;
+    for (int j = 0; j < 30; j++) {
+      auto & attr = state.smartval.vendor_attributes[j];
+      attr.id = j + 1; attr.current = attr.worst = 100;
+      attr.raw[0] = (unsigned char)(i + j);
+    }
+    states.push_back(state);
+  }
+
+  bench_clock::time_point start = bench_clock::now();
+  for (int c = 0; c < numcycles; c++) {
+    for (unsigned i = 0; i < numdev; i++)
+      CHECK(old_write_dev_state_json(configs[i].json_state_file.c_str(), configs[i], states[i]));
+  }
+  double old_time = seconds_since(start);
+
+  start = bench_clock::now();
+  for (int c = 0; c < numcycles; c++) {
+    for (auto & state : states)
+      state.json_dirty = true;
+    write_all_dev_states_json(configs, states);
+    for (const auto & state : states)
+      CHECK(!state.json_dirty);
+  }
+  double new_time = seconds_since(start);
+
+  for (const auto & cfg : configs)
+    CHECK(!unlink(cfg.json_state_file.c_str()));
+  CHECK(!rmdir(dir));
+  json_state_path_prefix.clear();
+  printf("Bench JSON state files, %u devices, %d cycles: %.3fs before, %.3fs batched\n",
+         numdev, numcycles, old_time, new_time);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+int main(int argc, char ** argv)
+{
+  full_benchmarks = (argc > 1 && !strcmp(argv[1], "-f"));
+
+  // Drop all messages
+  lib_global_hook::set(the_smartd_hook);
+  deferred_call_list quiet;
+  deferred_calls = &quiet;
+
+  smart_interface::init();
+  if (!smi())
+    return 1;
+
+  bool ok = true;
+  ok &= run_test("scheduled-tests", test_scheduled_tests);
+  ok &= run_test("check-scheduler", test_check_scheduler);
+  ok &= run_test("find-unchanged-device", test_find_unchanged_device);
+  ok &= run_test("register-devices-reload", test_register_devices_reload);
+  ok &= run_test("state-files", test_state_files);
+  ok &= run_test("json-state-files", test_json_state_files);
+  return (ok ? 0 : 1);
+}